@@ -0,0 +1,364 @@
+/*
+ * Benchmarks of HashMap against std::unordered_map.
+ *
+ * Every workload runs for int (random uint64_t), strided (uint64_t multiples of kStride, IDs
+ * whose low bits are all zero) and string keys at table sizes from L1-resident up to --max-mb
+ * of table memory, and reports ns/op, Mops/s and peak RSS of the case.
+ * Keys and access sequences come from a fixed seed, so runs are comparable. Peak RSS covers
+ * the keys and access sequences of the case as well as the table.
+ *
+ * usage: HashMapBench [--max-mb N] [--seed N] [--filter substring]
+ *   --max-mb   largest table to build, 256 by default, 1024 for the 1 GB tables
+ *   --filter   runs only the cases whose "workload/map/key" name contains the substring
+ */
+
+#include "hash_map.h"
+#include "hash_map_hashers.h"
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+
+namespace bench {
+
+struct Options {
+    size_t max_mb = 256;
+    uint64_t seed = 17239;
+    std::string filter;
+};
+
+// bijective mixer: distinct indices give distinct keys
+uint64_t splitmix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// strided keys defeat an identity hash that indexes by the low bits
+enum class KeyPattern { kRandom, kStrided };
+constexpr uint64_t kStride = 1024;
+
+template <class Key> Key make_key(uint64_t index, KeyPattern pattern);
+
+template <> uint64_t make_key<uint64_t>(uint64_t index, KeyPattern pattern) {
+    return pattern == KeyPattern::kStrided ? index * kStride : splitmix(index);
+}
+
+// 20+ characters, longer than the small string buffer
+template <> std::string make_key<std::string>(uint64_t index, KeyPattern) {
+    return "key:" + std::to_string(splitmix(index));
+}
+
+template <class Key> const char* key_name(KeyPattern pattern);
+template <> const char* key_name<uint64_t>(KeyPattern pattern) {
+    return pattern == KeyPattern::kStrided ? "strided" : "int";
+}
+template <> const char* key_name<std::string>(KeyPattern) {
+    return "string";
+}
+
+// indices in [0, n) drawn uniformly
+std::vector<uint32_t> uniform_indices(size_t n, size_t count, uint64_t seed) {
+    std::vector<uint32_t> result(count);
+    for (size_t i = 0; i < count; i++) {
+        result[i] = static_cast<uint32_t>(splitmix(seed + i) % n);
+    }
+    return result;
+}
+
+// Zipf(theta) indices in [0, n), the generator of Gray et al. used by YCSB; rank 0 is
+// the hottest, ranks are scattered over the keys so hot keys don't share cache lines
+std::vector<uint32_t> zipf_indices(size_t n, size_t count, uint64_t seed, double theta = 0.99) {
+    double zeta_n = 0;
+    for (size_t i = 1; i <= n; i++) {
+        zeta_n += 1 / std::pow(static_cast<double>(i), theta);
+    }
+    double zeta_2 = 1 + 1 / std::pow(2.0, theta);
+    double alpha = 1 / (1 - theta);
+    double eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta_2 / zeta_n);
+    std::vector<uint32_t> result(count);
+    for (size_t i = 0; i < count; i++) {
+        double u = static_cast<double>(splitmix(seed + i) >> 11) / static_cast<double>(uint64_t(1) << 53);
+        double uz = u * zeta_n;
+        size_t rank;
+        if (uz < 1) {
+            rank = 0;
+        } else if (uz < zeta_2) {
+            rank = 1;
+        } else {
+            rank = static_cast<size_t>(n * std::pow(eta * u - eta + 1, alpha));
+        }
+        result[i] = static_cast<uint32_t>(splitmix(std::min(rank, n - 1) ^ seed) % n);
+    }
+    return result;
+}
+
+// resets the peak RSS where the system allows it (Linux), returns whether it did
+bool reset_peak_rss() {
+#if defined(__linux__)
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    return static_cast<bool>(clear_refs);
+#else
+    return false;
+#endif
+}
+
+// peak RSS in MiB: since the last reset on Linux, of the whole process elsewhere
+double peak_rss_mb() {
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::strtod(line.c_str() + 6, nullptr) / 1024;
+        }
+    }
+#endif
+#if defined(__linux__) || defined(__APPLE__)
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1048576.0;
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// keeps results observable, so the compiler can't drop the measured loops
+volatile uint64_t sink;
+
+class Timer {
+public:
+    Timer() : start_(std::chrono::steady_clock::now()) {}
+
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+// fits the longest "workload/map/key" name, lookup_zipf/HashMap<FastHash>/strided
+constexpr int kNameWidth = 40;
+
+void report(const std::string& name, size_t size, size_t ops, double seconds) {
+    double ns = seconds * 1e9 / ops;
+    std::printf("%-*s %10zu %10.2f %10.2f %10.1f\n", kNameWidth, name.c_str(), size, ns, ops / seconds / 1e6,
+                peak_rss_mb());
+    std::fflush(stdout);
+}
+
+template <class Key> uint64_t weight(const Key& key) {
+    if constexpr (std::is_same<Key, std::string>::value) {
+        return key.size();
+    } else {
+        return key;
+    }
+}
+
+/*
+ * The workloads of one map type and key type at one size.
+ * `keys` are the n keys in the table, `other` are n keys that are never inserted.
+ */
+template <class Map, class Key> class Suite {
+public:
+    Suite(const Options& options, const char* map_name, size_t n, KeyPattern pattern)
+        : options_(options), map_name_(map_name), n_(n), pattern_(pattern),
+          // at least a few million operations, so small tables aren't timed for microseconds
+          ops_(std::max<size_t>(n, size_t(1) << 22)) {
+        keys_.reserve(n_);
+        other_.reserve(n_);
+        for (size_t i = 0; i < n_; i++) {
+            keys_.push_back(make_key<Key>(i, pattern_));
+            other_.push_back(make_key<Key>(i + n_, pattern_));
+        }
+        // a sequence of at most 4M indices, replayed to reach ops_
+        size_t len = std::min(ops_, size_t(1) << 22);
+        uniform_ = uniform_indices(n_, len, options_.seed);
+        zipf_ = zipf_indices(n_, len, options_.seed);
+    }
+
+    void run() {
+        run_case("insert", [&] {
+            Map map;
+            for (size_t i = 0; i < n_; i++) {
+                map[keys_[i]] = i;
+            }
+            sink = map.size();
+            return n_;
+        });
+        run_on_table("lookup_hit", [&](Map& map) {
+            return lookups(map, 1.0);
+        });
+        run_on_table("lookup_50", [&](Map& map) {
+            return lookups(map, 0.5);
+        });
+        run_on_table("lookup_miss", [&](Map& map) {
+            return lookups(map, 0.0);
+        });
+        run_on_table("lookup_zipf", [&](Map& map) {
+            uint64_t found = 0;
+            for (size_t i = 0; i < ops_; i++) {
+                found += map.find(keys_[zipf_[i % zipf_.size()]]) != map.end();
+            }
+            sink = found;
+            return ops_;
+        });
+        // steady size: every step erases the oldest key and inserts a fresh one, the two key
+        // sets swap places every n steps
+        run_on_table("churn", [&](Map& map) {
+            size_t steps = ops_ / 2;
+            for (size_t i = 0; i < steps; i++) {
+                size_t j = i % n_;
+                bool odd = (i / n_) & 1;
+                map.erase(odd ? other_[j] : keys_[j]);
+                map[odd ? keys_[j] : other_[j]] = i;
+            }
+            sink = map.size();
+            return steps * 2;
+        });
+        // word-count style: repeated keys hit, the value is updated in place
+        run_case("count_zipf", [&] {
+            Map map;
+            for (size_t i = 0; i < ops_; i++) {
+                map[keys_[zipf_[i % zipf_.size()]]]++;
+            }
+            sink = map.size();
+            return ops_;
+        });
+        run_on_table("iterate", [&](Map& map) {
+            uint64_t sum = 0;
+            size_t visited = 0;
+            while (visited < ops_) {
+                for (const auto& keyvalue : map) {
+                    sum += weight(keyvalue.first) + keyvalue.second;
+                }
+                visited += map.size();
+            }
+            sink = sum;
+            return visited;
+        });
+    }
+
+private:
+    const Options& options_;
+    const char* map_name_;
+    size_t n_;
+    KeyPattern pattern_;
+    size_t ops_;
+    std::vector<Key> keys_;
+    std::vector<Key> other_;
+    std::vector<uint32_t> uniform_;
+    std::vector<uint32_t> zipf_;
+
+    std::string name(const char* workload) const {
+        return std::string(workload) + "/" + map_name_ + "/" + key_name<Key>(pattern_);
+    }
+
+    bool selected(const char* workload) const {
+        return name(workload).find(options_.filter) != std::string::npos;
+    }
+
+    // f builds what it needs and returns the number of operations it timed
+    template <class F> void run_case(const char* workload, F&& f) {
+        if (!selected(workload)) {
+            return;
+        }
+        reset_peak_rss();
+        Timer timer;
+        size_t ops = f();
+        report(name(workload), n_, ops, timer.seconds());
+    }
+
+    // f runs on a table holding all the keys, building it isn't timed
+    template <class F> void run_on_table(const char* workload, F&& f) {
+        if (!selected(workload)) {
+            return;
+        }
+        reset_peak_rss();
+        Map map;
+        for (size_t i = 0; i < n_; i++) {
+            map[keys_[i]] = i;
+        }
+        Timer timer;
+        size_t ops = f(map);
+        report(name(workload), n_, ops, timer.seconds());
+    }
+
+    // a hit_ratio share of the lookups looks for present keys, taken in the same random order
+    uint64_t lookups(Map& map, double hit_ratio) {
+        size_t hits = static_cast<size_t>(hit_ratio * 1024);
+        uint64_t found = 0;
+        for (size_t i = 0; i < ops_; i++) {
+            uint32_t index = uniform_[i % uniform_.size()];
+            const Key& key = (splitmix(i) & 1023) < hits ? keys_[index] : other_[index];
+            found += map.find(key) != map.end();
+        }
+        sink = found;
+        return ops_;
+    }
+};
+
+// bytes a table of n elements may take at its largest, right after growth
+template <class Key> size_t table_bytes(size_t n) {
+    size_t element = sizeof(std::pair<Key, uint64_t>) + 16;
+    if (std::is_same<Key, std::string>::value) {
+        element += 32;
+    }
+    return n * element * 4;
+}
+
+template <class Key> void run_key(const Options& options, KeyPattern pattern = KeyPattern::kRandom) {
+    for (size_t n = 256; table_bytes<Key>(n) <= options.max_mb << 20; n *= 8) {
+        Suite<HashMap<Key, uint64_t>, Key>(options, "HashMap", n, pattern).run();
+        Suite<HashMap<Key, uint64_t, std::hash<Key>, std::equal_to<Key>, SplitStorage>, Key>(
+                options, "HashMap<Split>", n, pattern).run();
+        Suite<HashMap<Key, uint64_t, FastHash<Key>>, Key>(options, "HashMap<FastHash>", n, pattern).run();
+        if constexpr (std::is_integral<Key>::value) {
+            Suite<IntHashMap<Key, uint64_t>, Key>(options, "IntHashMap", n, pattern).run();
+        }
+        Suite<std::unordered_map<Key, uint64_t>, Key>(options, "unordered_map", n, pattern).run();
+    }
+}
+
+} // namespace bench
+
+int main(int argc, char** argv) {
+    bench::Options options;
+    for (int i = 1; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--max-mb") && i + 1 < argc) {
+            options.max_mb = std::strtoull(argv[++i], nullptr, 10);
+        } else if (!std::strcmp(argv[i], "--seed") && i + 1 < argc) {
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (!std::strcmp(argv[i], "--filter") && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--max-mb N] [--seed N] [--filter substring]\n";
+            return 1;
+        }
+    }
+    std::printf("%-*s %10s %10s %10s %10s\n", bench::kNameWidth, "workload/map/key", "size", "ns/op", "Mops/s",
+                "peak MiB");
+    bench::run_key<uint64_t>(options);
+    bench::run_key<uint64_t>(options, bench::KeyPattern::kStrided);
+    bench::run_key<std::string>(options);
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+ * Read-mostly concurrent Robin Hood hash table.
+ *
+ * Keys are split into Segments by the high bits of their mixed hash; every segment is a HashMap
+ * guarded by a writer mutex and a seqlock version. Writers lock only their segment and make the
+ * version odd while they change slots. Readers take no locks: they probe the segment's table,
+ * copy the value out and retry if the version was odd or changed meanwhile. That's why keys
+ * and values must be trivially copyable - a reader may see a half-written slot before it retries.
+ *
+ * Readers copy every metadata byte, key and value they look at with relaxed atomic loads and
+ * compare only the copies, so Equal never sees bytes change under it. Writers still
+ * store through a plain HashMap, so a reader overlapping a writer is formally a data race
+ * (ThreadSanitizer reports it): it's benign because the version check discards such a read.
+ *
+ * Growth never reallocates a table readers may be probing: the writer fills a bigger copy and
+ * publishes it, the old table is retired and freed only with the map (retired tables of
+ * a segment take less memory than its current one).
+ *
+ * There are no iterators. for_each() visits one segment at a time under its writer lock:
+ * an element present during the whole call is visited exactly once, elements inserted
+ * or erased concurrently in other segments may or may not be visited.
+ */
+
+#pragma once
+
+#include "hash_map.h"
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <thread>
+
+
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType>, class Equal = std::equal_to<KeyType>,
+         size_t Segments = 64>
+class ConcurrentHashMap {
+    static_assert(std::is_trivially_copyable<KeyType>::value && std::is_trivially_copyable<ValueType>::value,
+                  "lock-free readers copy slots that may be under modification");
+    static_assert(Segments && (Segments & (Segments - 1)) == 0, "segment count must be a power of two");
+
+public:
+    // split metadata gives readers a byte array to load atomically
+    using Table = HashMap<KeyType, ValueType, Hash, Equal, SplitStorage>;
+
+    explicit ConcurrentHashMap(Hash hasher = Hash(), Equal key_equal = Equal())
+        : hasher_(hasher), key_equal_(key_equal) {
+        for (Segment& segment : segments_) {
+            segment.retired.push_back(std::make_unique<Table>(hasher, key_equal));
+            segment.table.store(segment.retired.back().get(), std::memory_order_relaxed);
+        }
+    }
+
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator = (const ConcurrentHashMap&) = delete;
+
+    // sum of segment sizes, exact only without concurrent writers
+    size_t size() const {
+        size_t result = 0;
+        for (const Segment& segment : segments_) {
+            result += segment.size.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // lock-free reads
+    bool find(const KeyType& key, ValueType& value) const {
+        size_t hash = hash_map_detail::mix_hash(hasher_(key));
+        const Segment& segment = segment_of(hash);
+        while (true) {
+            uint64_t version = segment.version.load(std::memory_order_acquire);
+            if (version & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            const Table* table = segment.table.load(std::memory_order_acquire);
+            bool found = probe(*table, hash, key, value);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (segment.version.load(std::memory_order_relaxed) == version) {
+                return found;
+            }
+        }
+    }
+
+    std::optional<ValueType> find(const KeyType& key) const {
+        ValueType value;
+        if (find(key, value)) {
+            return value;
+        }
+        return std::nullopt;
+    }
+
+    bool contains(const KeyType& key) const {
+        ValueType value;
+        return find(key, value);
+    }
+
+    size_t count(const KeyType& key) const {
+        return contains(key);
+    }
+
+    // writes lock the key's segment; return whether the key was absent
+    bool insert(const KeyType& key, const ValueType& value) {
+        return write(key, [&](Table& table) {
+            return table.try_emplace(key, value).second;
+        });
+    }
+
+    bool insert_or_assign(const KeyType& key, const ValueType& value) {
+        return write(key, [&](Table& table) {
+            return table.insert_or_assign(key, value).second;
+        });
+    }
+
+    // returns whether the key was present
+    bool erase(const KeyType& key) {
+        size_t hash = hash_map_detail::mix_hash(hasher_(key));
+        Segment& segment = segment_of(hash);
+        std::lock_guard<std::mutex> lock(segment.mutex);
+        Table& table = *segment.table.load(std::memory_order_relaxed);
+        if (!table.contains(key)) {
+            return false;
+        }
+        begin_write(segment);
+        table.erase(key);
+        end_write(segment);
+        segment.size.store(table.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    // clears in place, keeping the capacity: a fresh table would pile up in the retired list
+    void clear() {
+        for (Segment& segment : segments_) {
+            std::lock_guard<std::mutex> lock(segment.mutex);
+            begin_write(segment);
+            segment.table.load(std::memory_order_relaxed)->clear();
+            end_write(segment);
+            segment.size.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // calls f(key, value) for every element, see the header comment for the guarantees
+    template <class F> void for_each(F&& f) const {
+        for (const Segment& segment : segments_) {
+            std::lock_guard<std::mutex> lock(segment.mutex);
+            for (const auto& keyvalue : *segment.table.load(std::memory_order_relaxed)) {
+                f(keyvalue.first, keyvalue.second);
+            }
+        }
+    }
+
+private:
+    // writers of a segment only contend with each other, each segment gets its own cache lines
+    struct alignas(64) Segment {
+        mutable std::mutex mutex;
+        std::atomic<uint64_t> version{0};
+        std::atomic<Table*> table{nullptr};
+        std::atomic<size_t> size{0};
+        // the current table and the ones readers may still probe
+        std::vector<std::unique_ptr<Table>> retired;
+    };
+
+    Hash hasher_;
+    Equal key_equal_;
+    Segment segments_[Segments];
+
+    static constexpr size_t segment_bits() {
+        size_t bits = 0;
+        while ((size_t(1) << bits) < Segments) {
+            bits++;
+        }
+        return bits;
+    }
+
+    // high hash bits pick the segment, the tables index by the low ones
+    Segment& segment_of(size_t hash) {
+        return segments_[segment_bits() ? hash >> (sizeof(size_t) * 8 - segment_bits()) : 0];
+    }
+
+    const Segment& segment_of(size_t hash) const {
+        return segments_[segment_bits() ? hash >> (sizeof(size_t) * 8 - segment_bits()) : 0];
+    }
+
+    // copies an object a writer may be changing with relaxed loads of its aligned words,
+    // the version check discards a copy torn between words
+    template <class T> static void racy_copy(void* to, const T& from) {
+        using Word = std::conditional_t<alignof(T) % 8 == 0, uint64_t,
+                     std::conditional_t<alignof(T) % 4 == 0, uint32_t,
+                     std::conditional_t<alignof(T) % 2 == 0, uint16_t, uint8_t>>>;
+        const Word* source = reinterpret_cast<const Word*>(&from);
+        Word* target = static_cast<Word*>(to);
+        for (size_t i = 0; i < sizeof(T) / sizeof(Word); i++) {
+            target[i] = __atomic_load_n(source + i, __ATOMIC_RELAXED);
+        }
+    }
+
+    // plain Robin Hood probe over slot copies, bounded since a writer may be shifting the run meanwhile
+    static bool probe(const Table& table, size_t hash, const KeyType& key, ValueType& value) {
+        // a segment that was never written has no slots
+        if (table.buffer_size_ == 0) {
+            return false;
+        }
+        const uint8_t* meta = table.data_.meta_data();
+        size_t mask = table.buffer_size_ - 1;
+        size_t index = hash & mask;
+        for (size_t dist = 0; dist <= mask; dist++) {
+            uint8_t slot_meta = __atomic_load_n(meta + index, __ATOMIC_RELAXED);
+            if (slot_meta == Table::kEmpty || (slot_meta != Table::kSaturated && size_t(slot_meta - 1) < dist)) {
+                return false;
+            }
+            alignas(KeyType) unsigned char key_copy[sizeof(KeyType)];
+            racy_copy(key_copy, table.data_.kv(index).first);
+            const KeyType& slot_key = *std::launder(reinterpret_cast<const KeyType*>(key_copy));
+            if (slot_meta == Table::kSaturated && ((index - table.full_hash(slot_key)) & mask) < dist) {
+                return false;
+            }
+            if (table.key_equal_(slot_key, key)) {
+                racy_copy(&value, table.data_.kv(index).second);
+                return true;
+            }
+            index = (index + 1) & mask;
+        }
+        return false;
+    }
+
+    static void begin_write(Segment& segment) {
+        segment.version.store(segment.version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    static void end_write(Segment& segment) {
+        segment.version.store(segment.version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // runs f on the key's table under the segment lock, growing it out of place beforehand
+    template <class F> bool write(const KeyType& key, F&& f) {
+        size_t hash = hash_map_detail::mix_hash(hasher_(key));
+        Segment& segment = segment_of(hash);
+        std::lock_guard<std::mutex> lock(segment.mutex);
+        Table* table = segment.table.load(std::memory_order_relaxed);
+        if (table->size() + 1 > table->bucket_count() * table->max_load_factor() && !table->contains(key)) {
+            auto bigger = std::make_unique<Table>(hasher_, key_equal_);
+            bigger->rehash(table->bucket_count() * 2);
+            for (const auto& keyvalue : *table) {
+                bigger->insert(keyvalue);
+            }
+            table = bigger.get();
+            segment.retired.push_back(std::move(bigger));
+            segment.table.store(table, std::memory_order_release);
+        }
+        // the table has room, so f doesn't allocate while readers are kept out
+        begin_write(segment);
+        bool result = f(*table);
+        end_write(segment);
+        segment.size.store(table->size(), std::memory_order_relaxed);
+        return result;
+    }
+};
@@ -0,0 +1,241 @@
+/*
+ * Immutable Robin Hood hash table for read-only serving.
+ *
+ * FrozenHashMap is built once from a map and exposes only const lookups. It takes the smallest
+ * power of two capacity whose maximum PSL doesn't exceed the target (doubling at most up to
+ * kMaxSpread slots per element, since equal hashes can't be spread at all), places the keys
+ * with Robin Hood insertion that breaks PSL ties by the full hash, and keeps the hashes of the slots.
+ *
+ * So every run is ordered by ideal slot and then by hash, and a lookup stops at a slot of its
+ * ideal slot with a greater hash, at a richer slot, or after max_psl() + 1 probes at most.
+ */
+
+#pragma once
+
+#include "hash_map.h"
+
+
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType>, class Equal = std::equal_to<KeyType>>
+class FrozenHashMap {
+
+public:
+    using KvType = std::pair<KeyType, ValueType>;
+    static constexpr uint8_t kEmpty = 0;
+    static constexpr uint8_t kSaturated = 0xFF;
+    static constexpr size_t kDefaultMaxPsl = 8;
+    static constexpr size_t kMaxSpread = 16;
+
+    using Slots = SplitStorage::slots<KvType, true>;
+
+    struct const_iterator {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<const KeyType, ValueType>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        explicit const_iterator() : map_(nullptr) {}
+
+        explicit const_iterator(const FrozenHashMap *map, size_t idx) : map_(map), idx_(idx) {}
+
+        bool operator==(const const_iterator &other) const {
+            return other.map_ == map_ && other.idx_ == idx_;
+        }
+        bool operator!=(const const_iterator &other) const {
+            return !(other == *this);
+        }
+
+        const_iterator &operator++() {
+            ++idx_;
+            advance_past_empty();
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        reference operator*() const {
+            return *operator->();
+        }
+
+        pointer operator->() const {
+            // casting std::pair<KeyType, ValueType> to std::pair<const KeyType, ValueType>
+            return reinterpret_cast<pointer>(&map_->data_.kv(idx_));
+        }
+
+    private:
+        void advance_past_empty() {
+            while (idx_ < map_->data_.size() && map_->data_.meta(idx_) == kEmpty) {
+                ++idx_;
+            }
+        }
+
+        const FrozenHashMap *map_ = nullptr;
+        size_t idx_ = 0;
+        friend FrozenHashMap;
+    };
+
+    using iterator = const_iterator;
+
+    // freezes any map with begin / end, hash_function and key_eq (its keys must be distinct)
+    template <class Map>
+    explicit FrozenHashMap(const Map& map, size_t target_max_psl = kDefaultMaxPsl)
+        : hasher_(map.hash_function()), key_equal_(map.key_eq()) {
+        using Element = std::remove_reference_t<decltype(*map.begin())>;
+        std::vector<std::pair<Element*, size_t>> elements;
+        elements.reserve(map.size());
+        for (const auto& keyvalue : map) {
+            elements.push_back({&keyvalue, hash_map_detail::mix_hash(hasher_(keyvalue.first))});
+        }
+        size_t buckets = 16;
+        while (buckets <= elements.size()) {
+            buckets *= 2;
+        }
+        while (true) {
+            build(elements, buckets);
+            if (max_psl_ <= target_max_psl || buckets >= kMaxSpread * elements.size()) {
+                break;
+            }
+            buckets *= 2;
+        }
+    }
+
+    // simple functions
+    size_t size() const {
+        return cnt_all_;
+    }
+
+    bool empty() const {
+        return cnt_all_ == 0;
+    }
+
+    size_t bucket_count() const {
+        return data_.size();
+    }
+
+    // the longest probe sequence, no lookup probes more than max_psl() + 1 slots
+    size_t max_psl() const {
+        return max_psl_;
+    }
+
+    Hash hash_function() const {
+        return hasher_;
+    }
+
+    Equal key_eq() const {
+        return key_equal_;
+    }
+
+    const_iterator begin() const {
+        const_iterator it(this, 0);
+        it.advance_past_empty();
+        return it;
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, data_.size());
+    }
+
+    // lookups
+    const_iterator find(const KeyType& key) const {
+        return const_iterator(this, find_index(key));
+    }
+
+    size_t count(const KeyType& key) const {
+        return find_index(key) != data_.size();
+    }
+
+    bool contains(const KeyType& key) const {
+        return find_index(key) != data_.size();
+    }
+
+    const ValueType& at(const KeyType& key) const {
+        size_t index = find_index(key);
+        if (index == data_.size()) {
+            throw std::out_of_range("very sad:(");
+        }
+        return data_.kv(index).second;
+    }
+
+private:
+    Hash hasher_;
+    Equal key_equal_;
+    Slots data_;
+    size_t cnt_all_ = 0;
+    size_t max_psl_ = 0;
+
+    static uint8_t encode_dist(size_t dist) {
+        return dist + 1 < kSaturated ? static_cast<uint8_t>(dist + 1) : kSaturated;
+    }
+
+    size_t get_dist(size_t index) const {
+        uint8_t meta = data_.meta(index);
+        if (meta != kSaturated) {
+            return meta - 1;
+        }
+        return (index - data_.hash(index)) & (data_.size() - 1);
+    }
+
+    // Robin Hood insertion of every element, the element with the lower hash wins a PSL tie
+    template <class Elements> void build(const Elements& elements, size_t buckets) {
+        data_ = Slots(buckets);
+        cnt_all_ = 0;
+        max_psl_ = 0;
+        size_t mask = buckets - 1;
+        for (const auto& element : elements) {
+            KvType keyvalue(element.first->first, element.first->second);
+            size_t hash = element.second;
+            size_t index = hash & mask;
+            size_t dist = 0;
+            while (data_.meta(index) != kEmpty) {
+                size_t slot_dist = get_dist(index);
+                if (slot_dist < dist || (slot_dist == dist && data_.hash(index) > hash)) {
+                    std::swap(keyvalue, data_.kv(index));
+                    size_t slot_hash = data_.hash(index);
+                    data_.set_hash(index, hash);
+                    data_.set_meta(index, encode_dist(dist));
+                    max_psl_ = std::max(max_psl_, dist);
+                    hash = slot_hash;
+                    dist = slot_dist;
+                }
+                index = (index + 1) & mask;
+                dist++;
+            }
+            data_.construct(index, std::move(keyvalue));
+            data_.set_hash(index, hash);
+            data_.set_meta(index, encode_dist(dist));
+            max_psl_ = std::max(max_psl_, dist);
+            cnt_all_++;
+        }
+    }
+
+    // bounded probe: the run is sorted by ideal slot and then by hash
+    size_t find_index(const KeyType& key) const {
+        size_t hash = hash_map_detail::mix_hash(hasher_(key));
+        size_t mask = data_.size() - 1;
+        size_t index = hash & mask;
+        for (size_t dist = 0; dist <= max_psl_; dist++) {
+            if (data_.meta(index) == kEmpty) {
+                break;
+            }
+            size_t slot_dist = get_dist(index);
+            if (slot_dist < dist) {
+                break;
+            }
+            if (slot_dist == dist) {
+                size_t slot_hash = data_.hash(index);
+                if (slot_hash == hash && key_equal_(data_.kv(index).first, key)) {
+                    return index;
+                }
+                if (slot_hash > hash) {
+                    break;
+                }
+            }
+            index = (index + 1) & mask;
+        }
+        return data_.size();
+    }
+};
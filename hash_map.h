@@ -1,310 +1,2566 @@
-/*
- * Realization of Robin Hood hash table (open addressing).
- *
- * The algorithm is based on the notion of probe sequence lengths (PSL). The PSL of a key
- * is the number of probes required to find the key during lookup.
- *
- * A key with a low PSL can be thought of as rich, and a key with a high PSL can be thought of as poor.
- * When inserting a new key the algorithm moves the rich in favor
- * of the poor (“takes from the rich and gives to the poor”), hence the name Robin Hood hashing.
- */
-
-#include <vector>
-#include <stdexcept>
-#include "list"
-
-
-template<class KeyType, class ValueType, class Hash = std::hash<KeyType> > class HashMap{
-
-public:
-    using KvType = std::pair<KeyType, ValueType>;
-    // define hash map element
-    struct Node {
-        KvType keyvalue;
-        int status;
-        size_t dist_to_ideal;
-
-        Node() {
-            status = -1;
-            dist_to_ideal = 0;
-        }
-
-        explicit Node(KvType p, size_t dist) {
-            keyvalue = p;
-            status = 1;
-            dist_to_ideal = dist;
-        }
-    };
-
-    // define hash map iterators
-    template <typename ContT, typename IterVal> struct hm_iterator {
-        explicit hm_iterator() : hm_(nullptr) {}
-
-        explicit hm_iterator(ContT *hm) : hm_(hm) { advance_past_empty(); }
-
-        explicit hm_iterator(ContT *hm, size_t idx) : hm_(hm), idx_(idx) {}
-
-        template <typename OtherContT, typename OtherIterVal>
-        explicit hm_iterator(const hm_iterator<OtherContT, OtherIterVal> &other): hm_(other.hm_), idx_(other.idx_) {}
-
-        bool operator==(const hm_iterator &other) const {
-            return other.hm_ == hm_ && other.idx_ == idx_;
-        }
-        bool operator!=(const hm_iterator &other) const {
-            return !(other == *this);
-        }
-
-        hm_iterator &operator++() {
-            ++idx_;
-            advance_past_empty();
-            return *this;
-        }
-
-        hm_iterator operator++(int) {
-            auto tmp = *this;
-            ++idx_;
-            advance_past_empty();
-            return tmp;
-        }
-        
-
-        IterVal& operator*() {
-            return *get_cur_pointer();
-        }
-
-        IterVal* operator->() {
-              return get_cur_pointer();
-        }
-
-    private:
-        void advance_past_empty() {
-            while (idx_ < hm_->data_.size() && hm_->data_[idx_].status != 1) {
-                ++idx_;
-            }
-        }
-
-        auto get_cur_pointer() {
-            // casting std::pair<KeyType, ValueType> to std::pair<const KeyType, ValueType>
-            return reinterpret_cast<IterVal*> (&(hm_->data_[idx_].keyvalue));
-        }
-
-        ContT *hm_ = nullptr;
-        size_t idx_ = 0;
-        friend ContT;
-    };
-
-    using iterator = hm_iterator<HashMap, std::pair<const KeyType, ValueType>>;
-    using const_iterator = hm_iterator<const HashMap, const std::pair<const KeyType, ValueType>>;
-    
-    // constructors
-    explicit HashMap(Hash hasher_ = Hash()): hasher_(std::move(hasher_)){
-        buffer_size_ = default_size_;
-        cnt_all_ = 0;
-        cnt_dead_ = 0;
-        data_.resize(buffer_size_);
-    }
-
-    HashMap(const HashMap& other){
-        *this = other;
-    }
-    
-    HashMap& operator = (const HashMap& other) {
-        hasher_ = other.hasher_;
-        cnt_all_ = other.cnt_all_;
-        cnt_dead_ = other.cnt_dead_;
-        buffer_size_ = other.buffer_size_;
-        data_ = other.data_;
-        return *this;
-    }
-
-    HashMap(KvType* start, KvType* end) : HashMap(){
-        KvType* cur = start;
-        while(cur != end){
-            insert(*cur);
-            cur++;
-        }
-    }
-
-    HashMap(iterator begin, iterator end): HashMap(){
-        iterator cur = begin;
-        while(cur != end){
-            insert(*cur);
-            cur++;
-        }
-    }
-
-    HashMap(const_iterator begin, const_iterator end): HashMap(){
-        const_iterator cur = begin;
-        while(cur != end){
-            insert(*cur);
-            cur++;
-        }
-    }
-
-    HashMap(std::initializer_list<KvType> list): HashMap(){
-        auto cur = list.begin();
-        while(cur != list.end()){
-            insert(*cur);
-            cur++;
-        }
-    }
-
-    // simple functions
-    size_t size() const {
-        return cnt_all_ - cnt_dead_;
-    }
-
-    bool empty() const {
-        return cnt_all_ - cnt_dead_ == 0;
-    }
-
-    Hash hash_function() const {
-        return hasher_;
-    }
-
-    iterator begin() {
-        return iterator(this);
-    }
-
-    const_iterator begin() const {
-        return const_iterator(this);
-    }
-
-    iterator end() {
-        return iterator(this, data_.size());
-    }
-
-    const_iterator end() const {
-        return const_iterator(this, data_.size());
-    }
-
-    // not such simple functions
-    iterator insert(KvType keyvalue) {
-        resize();
-        KeyType key = keyvalue.first;
-        size_t h1 = get_hash(key);
-
-        size_t cur_dist_to_ideal = 0;
-        int insert_index = -1;
-        for (size_t i = 0; i < buffer_size_; i++, cur_dist_to_ideal++){
-            size_t index = (h1 + i) % buffer_size_;
-            if (data_[index].status == 1 && data_[index].keyvalue.first == key) {
-                return iterator(this, index);
-            }
-
-            // balancing Rich and Poor elements
-            if (data_[index].status == 1 && data_[index].dist_to_ideal < cur_dist_to_ideal) {
-                std::swap(data_[index].keyvalue, keyvalue);
-                std::swap(data_[index].dist_to_ideal, cur_dist_to_ideal);
-                if (insert_index == -1) {
-                    insert_index = static_cast<int>(index);
-                }
-            }
-
-            if (data_[index].status == -1) {
-                data_[index] = Node(keyvalue, cur_dist_to_ideal);
-                cnt_all_++;
-                if (insert_index == -1) {
-                    insert_index = static_cast<int>(index);
-                }
-                return iterator(this, insert_index);
-            }
-        }
-        return iterator(this, buffer_size_);
-    }
-
-    void erase(const KeyType& key) {
-        size_t h1 = get_hash(key);
-
-        for(size_t i = 0; i < buffer_size_; i++){
-            size_t index = (h1 + i) % buffer_size_;
-            if (data_[index].status == 1 && data_[index].keyvalue.first == key) {
-                data_[index].status = 0;
-                cnt_dead_++;
-            }
-            if (data_[index].status == -1) {
-                return;
-            }
-        }
-    }
-
-    iterator find(const KeyType& key) {
-        size_t h1 = get_hash(key);
-        for(size_t i = 0; i < buffer_size_; i++){
-            size_t index = (h1 + i) % buffer_size_;
-            if (data_[index].status == 1 && data_[index].keyvalue.first == key) {
-                return iterator(this, index);
-            }
-            if (data_[index].status == -1) {
-                return iterator(this, buffer_size_);
-            }
-        }
-        return iterator(this, buffer_size_);
-    }
-
-    const_iterator find(const KeyType& key) const {
-        size_t h1 = get_hash(key);
-        for(size_t i = 0; i < buffer_size_; i++){
-            size_t index = (h1 + i) % buffer_size_;
-            if (data_[index].status == 1 && data_[index].keyvalue.first == key) {
-                return const_iterator(this, index);
-            }
-            if (data_[index].status == -1) {
-                return const_iterator(this, buffer_size_);
-            }
-        }
-        return const_iterator(this, buffer_size_);
-    }
-
-    ValueType& operator [](KeyType key){
-        iterator it = find(key);
-        if (it == end()){
-            it = insert(std::pair<KeyType, ValueType>{key, ValueType()});
-        }
-        return it -> second;
-    }
-
-    const ValueType& at(const KeyType& key) const{
-        const_iterator it = find(key);
-        if (it == end()){
-            throw std::out_of_range("very sad:(");
-        }
-        return it -> second;
-    }
-
-    void clear() {
-        *this = HashMap<KeyType, ValueType, Hash>(hasher_);
-    }
-    
-private:
-    Hash hasher_;
-    std::vector<Node> data_;
-    size_t default_size_ = 16;
-    const double load_factor_ = 0.5;
-    size_t cnt_all_ = 0;
-    size_t cnt_dead_ = 0;
-    size_t buffer_size_ = 0;
-
-
-    size_t get_hash(const KeyType& k) const {
-        return hasher_(k) % buffer_size_;
-    }
-
-    void resize() {
-        if (buffer_size_ * load_factor_ < cnt_all_) {
-            buffer_size_ *= 2;
-        } else {
-            return;
-        }
-
-        cnt_dead_ = 0;
-        cnt_all_ = 0;
-        std::vector <Node> data_2(buffer_size_);
-        std::swap(data_, data_2);
-        for (size_t i = 0; i < data_2.size(); i++) {
-            if (data_2[i].status == 1) {
-                insert(data_2[i].keyvalue);
-            }
-        }
-    }
-};
\ No newline at end of file
+/*
+ * Realization of Robin Hood hash table (open addressing).
+ *
+ * The algorithm is based on the notion of probe sequence lengths (PSL). The PSL of a key
+ * is the number of probes required to find the key during lookup.
+ *
+ * A key with a low PSL can be thought of as rich, and a key with a high PSL can be thought of as poor.
+ * When inserting a new key the algorithm moves the rich in favor
+ * of the poor (“takes from the rich and gives to the poor”), hence the name Robin Hood hashing.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+#include <exception>
+#include <thread>
+#include "list"
+
+#if defined(HASH_MAP_NO_SIMD)
+#elif defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+
+namespace hash_map_detail {
+
+/*
+ * A group of consecutive metadata bytes compared at once.
+ *
+ * match_dist(base) compares the group against the PSLs a probe would have along the group
+ * (base, base + 1, ... in metadata encoding) and returns two bit masks:
+ * `match` - slots holding exactly the expected PSL (the only places the key may be),
+ * `stop` - slots holding a smaller PSL or empty ones, where Robin Hood probing stops.
+ * match_alive(base) returns the mask of occupied slots, iteration skips empty ones with it.
+ * The implementation is picked at compile time: AVX2, SSE2, NEON or a scalar fallback.
+ */
+struct GroupMask {
+    uint64_t match;
+    uint64_t stop;
+};
+
+#if defined(__AVX2__) && !defined(HASH_MAP_NO_SIMD)
+struct MetaGroup {
+    static constexpr size_t kWidth = 32;
+    static constexpr unsigned kShift = 0;
+
+    static GroupMask match_dist(const uint8_t* meta, uint8_t base, uint8_t saturated) {
+        const __m256i iota = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+        __m256i group = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(meta));
+        __m256i expected = _mm256_min_epu8(_mm256_adds_epu8(_mm256_set1_epi8(static_cast<char>(base)), iota),
+                _mm256_set1_epi8(static_cast<char>(saturated)));
+        __m256i not_less = _mm256_cmpeq_epi8(_mm256_max_epu8(group, expected), group);
+        uint32_t match = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(group, expected)));
+        uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(not_less));
+        return {match, stop};
+    }
+
+    static uint64_t match_alive(const uint8_t* meta) {
+        __m256i group = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(meta));
+        return ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(group, _mm256_setzero_si256())));
+    }
+};
+#elif defined(__SSE2__) && !defined(HASH_MAP_NO_SIMD)
+struct MetaGroup {
+    static constexpr size_t kWidth = 16;
+    static constexpr unsigned kShift = 0;
+
+    static GroupMask match_dist(const uint8_t* meta, uint8_t base, uint8_t saturated) {
+        const __m128i iota = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+        __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(meta));
+        __m128i expected = _mm_min_epu8(_mm_adds_epu8(_mm_set1_epi8(static_cast<char>(base)), iota),
+                _mm_set1_epi8(static_cast<char>(saturated)));
+        __m128i not_less = _mm_cmpeq_epi8(_mm_max_epu8(group, expected), group);
+        uint32_t match = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, expected)));
+        uint32_t stop = ~static_cast<uint32_t>(_mm_movemask_epi8(not_less)) & 0xFFFFu;
+        return {match, stop};
+    }
+
+    static uint64_t match_alive(const uint8_t* meta) {
+        __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(meta));
+        return ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_setzero_si128()))) & 0xFFFFu;
+    }
+};
+#elif defined(__ARM_NEON) && !defined(HASH_MAP_NO_SIMD)
+struct MetaGroup {
+    // NEON has no movemask, every slot is reported as a nibble of the 64 bit mask
+    static constexpr size_t kWidth = 16;
+    static constexpr unsigned kShift = 2;
+
+    static GroupMask match_dist(const uint8_t* meta, uint8_t base, uint8_t saturated) {
+        static const uint8_t kIota[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+        uint8x16_t group = vld1q_u8(meta);
+        uint8x16_t expected = vminq_u8(vqaddq_u8(vdupq_n_u8(base), vld1q_u8(kIota)), vdupq_n_u8(saturated));
+        return {to_mask(vceqq_u8(group, expected)), to_mask(vcltq_u8(group, expected))};
+    }
+
+    static uint64_t match_alive(const uint8_t* meta) {
+        uint8x16_t group = vld1q_u8(meta);
+        return to_mask(vtstq_u8(group, group));
+    }
+
+private:
+    static uint64_t to_mask(uint8x16_t bytes) {
+        uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(bytes), 4);
+        return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ull;
+    }
+};
+#else
+struct MetaGroup {
+    static constexpr size_t kWidth = 8;
+    static constexpr unsigned kShift = 0;
+
+    static GroupMask match_dist(const uint8_t* meta, uint8_t base, uint8_t saturated) {
+        GroupMask mask{0, 0};
+        for (size_t j = 0; j < kWidth; j++) {
+            size_t expected = base + j < saturated ? base + j : saturated;
+            if (meta[j] == expected) {
+                mask.match |= uint64_t(1) << j;
+            }
+            if (meta[j] < expected) {
+                mask.stop |= uint64_t(1) << j;
+            }
+        }
+        return mask;
+    }
+
+    static uint64_t match_alive(const uint8_t* meta) {
+        uint64_t mask = 0;
+        for (size_t j = 0; j < kWidth; j++) {
+            mask |= uint64_t(meta[j] != 0) << j;
+        }
+        return mask;
+    }
+};
+#endif
+
+// finalizer applied to user hashes before masking, so weak hashes (identity, strided keys)
+// still spread over the low bits: 64x64 -> 128 bit multiply folded back into 64 bits
+inline size_t mix_hash(size_t h) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = static_cast<__uint128_t>(static_cast<uint64_t>(h)) * 0x9E3779B97F4A7C15ull;
+    return static_cast<size_t>(static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64));
+#else
+    uint64_t x = static_cast<uint64_t>(h);
+    x = (x ^ (x >> 33)) * 0xFF51AFD7ED558CCDull;
+    x = (x ^ (x >> 33)) * 0xC4CEB9FE1A85EC53ull;
+    return static_cast<size_t>(x ^ (x >> 33));
+#endif
+}
+
+// hashers and key comparators with `is_transparent` accept any comparable key type
+template <class T, class = void> struct is_transparent : std::false_type {};
+template <class T> struct is_transparent<T, std::void_t<typename T::is_transparent>> : std::true_type {};
+
+template <class H, class E>
+using enable_transparent = std::enable_if_t<is_transparent<H>::value && is_transparent<E>::value, int>;
+
+// slots that reserve a key to mark empty slots, see SentinelStorage
+template <class Slots, class = void> struct has_empty_key : std::false_type {};
+template <class Slots> struct has_empty_key<Slots, std::void_t<decltype(Slots::kEmptyKey)>> : std::true_type {};
+
+// per slot hash cache; the empty specialization costs nothing as a base class
+template <bool StoreHash> struct StoredHash {
+    size_t hash = 0;
+
+    size_t get_hash() const {
+        return hash;
+    }
+
+    void set_hash(size_t h) {
+        hash = h;
+    }
+};
+
+template <> struct StoredHash<false> {
+    size_t get_hash() const {
+        return 0;
+    }
+
+    void set_hash(size_t) {}
+};
+
+// position of the lowest slot reported in a group mask
+inline size_t lowest_slot(uint64_t mask) {
+    return static_cast<size_t>(__builtin_ctzll(mask)) >> MetaGroup::kShift;
+}
+
+// read hint for a cache line that is going to be probed soon
+inline void prefetch(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address, 0, 3);
+#else
+    (void)address;
+#endif
+}
+
+// what a table has done so far; the probe counters exist only with HASH_MAP_STATS, which
+// changes the table layout, so all translation units must agree on it
+struct Counters {
+    size_t rehashes = 0;
+    double rehash_seconds = 0;
+#if defined(HASH_MAP_STATS)
+    uint64_t lookups = 0;
+    uint64_t lookup_probes = 0;
+    uint64_t inserts = 0;
+    uint64_t insert_probes = 0;
+#endif
+};
+
+// adds the lifetime of the scope to seconds
+class ScopedTimer {
+public:
+    explicit ScopedTimer(double& seconds) : seconds_(seconds), start_(std::chrono::steady_clock::now()) {}
+
+    ~ScopedTimer() {
+        seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    double& seconds_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace hash_map_detail
+
+
+/*
+ * Slot storage policies.
+ *
+ * A policy provides `template <class KvType, bool StoreHash, class Allocator> class slots` - a fixed
+ * size array of slots, where every slot has a one byte metadata (0 means empty) and room for a key-value pair.
+ * With StoreHash slots also keep the element's full hash (hash() / set_hash()), otherwise
+ * set_hash() is a no-op and nothing is stored.
+ * The pair of a slot is alive exactly when its metadata isn't 0: the owner constructs it
+ * before setting non-zero metadata and destroys it before resetting metadata to 0.
+ *
+ * The owner moves pairs between slots only with move_construct(i, source, j) (into a free slot i,
+ * from slot j of source, which may be this) and move_assign(i, j); the source pair stays alive
+ * in its moved-from state until it's assigned to or destroyed.
+ *
+ * prefetch(i) hints that slot i is going to be probed soon.
+ * clear() destroys every alive pair and empties all slots, keeping the arrays.
+ *
+ * Memory comes from Allocator rebound to the slot type. Copies, assignments and swaps follow
+ * allocator_traits propagation like the standard containers; moving into slots with an unequal,
+ * non-propagating allocator moves the pairs one by one.
+ *
+ * NodeStorage keeps metadata next to the pair (array of structures).
+ * SplitStorage keeps a dense metadata array and a parallel array of pairs (structure of arrays),
+ * so probing walks only metadata and touches a pair just on a candidate match.
+ *
+ * StableStorage keeps SplitStorage's metadata and an array of pointers to separately allocated pairs.
+ * SentinelStorage<EmptyKey> keeps just the pairs: a slot is empty when its key equals EmptyKey.
+ *
+ * Storages with kGroupProbing expose meta_data(): the metadata bytes followed by a copy
+ * of the first MetaGroup::kWidth - 1 of them, so a group can be loaded at any slot.
+ * Storages with kStableElements never move a pair once it's constructed.
+ * Storages without kStoresPsl report every occupied slot as saturated (0xFF) and
+ * ignore the PSL passed to set_meta, so the owner recomputes PSLs from hashes.
+ */
+struct NodeStorage {
+    template <class KvType, bool StoreHash, class Allocator = std::allocator<KvType>> class slots {
+        using AllocTraits = std::allocator_traits<Allocator>;
+
+    public:
+        static constexpr bool kGroupProbing = false;
+        static constexpr bool kStableElements = false;
+        static constexpr bool kStoresPsl = true;
+
+        explicit slots(size_t size = 0, const Allocator& alloc = Allocator()) : alloc_(alloc), size_(size) {
+            if (size_) {
+                nodes_ = NodeTraits::allocate(alloc_, size_);
+                for (size_t i = 0; i < size_; i++) {
+                    new (nodes_ + i) Node();
+                }
+            }
+        }
+
+        slots(const slots& other, const Allocator& alloc) : slots(other.size_, alloc) {
+            for (size_t i = 0; i < size_; i++) {
+                if (other.meta(i)) {
+                    construct(i, other.kv(i));
+                    nodes_[i].set_hash(other.hash(i));
+                    nodes_[i].meta = other.meta(i);
+                }
+            }
+        }
+
+        slots(const slots& other)
+            : slots(other, AllocTraits::select_on_container_copy_construction(other.get_allocator())) {}
+
+        slots(slots&& other) noexcept : alloc_(other.alloc_) {
+            take(other);
+        }
+
+        slots(slots&& other, const Allocator& alloc) : alloc_(alloc) {
+            if (alloc_ == other.alloc_) {
+                take(other);
+                return;
+            }
+            slots moved(other.size_, alloc);
+            for (size_t i = 0; i < other.size_; i++) {
+                if (other.meta(i)) {
+                    moved.construct(i, std::move(other.kv(i)));
+                    moved.nodes_[i].set_hash(other.hash(i));
+                    moved.nodes_[i].meta = other.meta(i);
+                }
+            }
+            take(moved);
+            other.release();
+        }
+
+        slots& operator = (const slots& other) {
+            if (this != &other) {
+                if constexpr (AllocTraits::propagate_on_container_copy_assignment::value) {
+                    slots copy(other, other.get_allocator());
+                    release();
+                    alloc_ = copy.alloc_;
+                    take(copy);
+                } else {
+                    slots copy(other, get_allocator());
+                    release();
+                    take(copy);
+                }
+            }
+            return *this;
+        }
+
+        slots& operator = (slots&& other) noexcept(AllocTraits::propagate_on_container_move_assignment::value ||
+                                                   AllocTraits::is_always_equal::value) {
+            if (this != &other) {
+                if constexpr (AllocTraits::propagate_on_container_move_assignment::value) {
+                    release();
+                    alloc_ = other.alloc_;
+                    take(other);
+                } else {
+                    slots moved(std::move(other), get_allocator());
+                    release();
+                    take(moved);
+                }
+            }
+            return *this;
+        }
+
+        ~slots() {
+            release();
+        }
+
+        void swap(slots& other) noexcept {
+            if constexpr (AllocTraits::propagate_on_container_swap::value) {
+                std::swap(alloc_, other.alloc_);
+            }
+            std::swap(nodes_, other.nodes_);
+            std::swap(size_, other.size_);
+        }
+
+        Allocator get_allocator() const {
+            return Allocator(alloc_);
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+        uint8_t meta(size_t i) const {
+            return nodes_[i].meta;
+        }
+
+        void set_meta(size_t i, uint8_t meta) {
+            nodes_[i].meta = meta;
+        }
+
+        size_t hash(size_t i) const {
+            return nodes_[i].get_hash();
+        }
+
+        void set_hash(size_t i, size_t hash) {
+            nodes_[i].set_hash(hash);
+        }
+
+        KvType& kv(size_t i) {
+            return nodes_[i].keyvalue;
+        }
+
+        const KvType& kv(size_t i) const {
+            return nodes_[i].keyvalue;
+        }
+
+        template <class... Args> void construct(size_t i, Args&&... args) {
+            new (&nodes_[i].keyvalue) KvType(std::forward<Args>(args)...);
+        }
+
+        void destroy(size_t i) {
+            nodes_[i].keyvalue.~KvType();
+        }
+
+        void move_construct(size_t i, slots& source, size_t j) {
+            construct(i, std::move(source.kv(j)));
+        }
+
+        void move_assign(size_t i, size_t j) {
+            nodes_[i].keyvalue = std::move(nodes_[j].keyvalue);
+        }
+
+        void clear() noexcept {
+            for (size_t i = 0; i < size_; i++) {
+                if (nodes_[i].meta) {
+                    destroy(i);
+                    nodes_[i].meta = 0;
+                }
+            }
+        }
+
+        void prefetch(size_t i) const {
+            hash_map_detail::prefetch(nodes_ + i);
+        }
+
+    private:
+        struct Node : hash_map_detail::StoredHash<StoreHash> {
+            union {
+                KvType keyvalue;
+            };
+            uint8_t meta = 0;
+
+            Node() {}
+            ~Node() {}
+        };
+
+        using NodeAlloc = typename AllocTraits::template rebind_alloc<Node>;
+        using NodeTraits = std::allocator_traits<NodeAlloc>;
+
+        // grabs the array of other, the allocators must be equal
+        void take(slots& other) noexcept {
+            nodes_ = other.nodes_;
+            size_ = other.size_;
+            other.nodes_ = nullptr;
+            other.size_ = 0;
+        }
+
+        // destroys the pairs and frees the array
+        void release() noexcept {
+            if (nodes_) {
+                for (size_t i = 0; i < size_; i++) {
+                    if (nodes_[i].meta) {
+                        destroy(i);
+                    }
+                }
+                NodeTraits::deallocate(alloc_, nodes_, size_);
+            }
+            nodes_ = nullptr;
+            size_ = 0;
+        }
+
+        NodeAlloc alloc_;
+        Node* nodes_ = nullptr;
+        size_t size_ = 0;
+    };
+};
+
+struct SplitStorage {
+    template <class KvType, bool StoreHash, class Allocator = std::allocator<KvType>> class slots {
+        using AllocTraits = std::allocator_traits<Allocator>;
+        using KvAlloc = typename AllocTraits::template rebind_alloc<KvType>;
+        using KvTraits = std::allocator_traits<KvAlloc>;
+        using MetaArray = std::vector<uint8_t, typename AllocTraits::template rebind_alloc<uint8_t>>;
+        using HashArray = std::vector<size_t, typename AllocTraits::template rebind_alloc<size_t>>;
+
+    public:
+        static constexpr bool kGroupProbing = true;
+        static constexpr bool kStableElements = false;
+        static constexpr bool kStoresPsl = true;
+
+        explicit slots(size_t size = 0, const Allocator& alloc = Allocator())
+            : meta_(size ? size + hash_map_detail::MetaGroup::kWidth - 1 : 0, 0, alloc),
+              hashes_(StoreHash ? size : 0, 0, alloc), alloc_(alloc), size_(size) {
+            if (size_) {
+                kv_ = KvTraits::allocate(alloc_, size_);
+            }
+        }
+
+        slots(const slots& other, const Allocator& alloc) : slots(other.size_, alloc) {
+            for (size_t i = 0; i < size_; i++) {
+                if (other.meta(i)) {
+                    construct(i, other.kv(i));
+                    set_hash(i, other.hash(i));
+                    set_meta(i, other.meta(i));
+                }
+            }
+        }
+
+        slots(const slots& other)
+            : slots(other, AllocTraits::select_on_container_copy_construction(other.get_allocator())) {}
+
+        slots(slots&& other) noexcept
+            : meta_(std::move(other.meta_)), hashes_(std::move(other.hashes_)), alloc_(other.alloc_),
+              kv_(other.kv_), size_(other.size_) {
+            other.meta_.clear();
+            other.hashes_.clear();
+            other.kv_ = nullptr;
+            other.size_ = 0;
+        }
+
+        slots(slots&& other, const Allocator& alloc) : meta_(alloc), hashes_(alloc), alloc_(alloc) {
+            if (alloc_ == other.alloc_) {
+                take(other);
+                return;
+            }
+            slots moved(other.size_, alloc);
+            for (size_t i = 0; i < other.size_; i++) {
+                if (other.meta(i)) {
+                    moved.construct(i, std::move(other.kv(i)));
+                    moved.set_hash(i, other.hash(i));
+                    moved.set_meta(i, other.meta(i));
+                }
+            }
+            take(moved);
+            other.release();
+        }
+
+        slots& operator = (const slots& other) {
+            if (this != &other) {
+                if constexpr (AllocTraits::propagate_on_container_copy_assignment::value) {
+                    slots copy(other, other.get_allocator());
+                    release();
+                    alloc_ = copy.alloc_;
+                    take(copy);
+                } else {
+                    slots copy(other, get_allocator());
+                    release();
+                    take(copy);
+                }
+            }
+            return *this;
+        }
+
+        slots& operator = (slots&& other) noexcept(AllocTraits::propagate_on_container_move_assignment::value ||
+                                                   AllocTraits::is_always_equal::value) {
+            if (this != &other) {
+                if constexpr (AllocTraits::propagate_on_container_move_assignment::value) {
+                    release();
+                    alloc_ = other.alloc_;
+                    take(other);
+                } else {
+                    slots moved(std::move(other), get_allocator());
+                    release();
+                    take(moved);
+                }
+            }
+            return *this;
+        }
+
+        ~slots() {
+            release();
+        }
+
+        void swap(slots& other) noexcept {
+            if constexpr (AllocTraits::propagate_on_container_swap::value) {
+                std::swap(alloc_, other.alloc_);
+            }
+            meta_.swap(other.meta_);
+            hashes_.swap(other.hashes_);
+            std::swap(kv_, other.kv_);
+            std::swap(size_, other.size_);
+        }
+
+        Allocator get_allocator() const {
+            return Allocator(alloc_);
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+        uint8_t meta(size_t i) const {
+            return meta_[i];
+        }
+
+        void set_meta(size_t i, uint8_t meta) {
+            meta_[i] = meta;
+            // keep the mirrored tail in sync
+            for (size_t j = i + size_; j < meta_.size(); j += size_) {
+                meta_[j] = meta;
+            }
+        }
+
+        const uint8_t* meta_data() const {
+            return meta_.data();
+        }
+
+        size_t hash(size_t i) const {
+            return StoreHash ? hashes_[i] : 0;
+        }
+
+        void set_hash(size_t i, size_t hash) {
+            if (StoreHash) {
+                hashes_[i] = hash;
+            }
+        }
+
+        KvType& kv(size_t i) {
+            return kv_[i];
+        }
+
+        const KvType& kv(size_t i) const {
+            return kv_[i];
+        }
+
+        template <class... Args> void construct(size_t i, Args&&... args) {
+            new (kv_ + i) KvType(std::forward<Args>(args)...);
+        }
+
+        void destroy(size_t i) {
+            kv_[i].~KvType();
+        }
+
+        void move_construct(size_t i, slots& source, size_t j) {
+            construct(i, std::move(source.kv(j)));
+        }
+
+        void move_assign(size_t i, size_t j) {
+            kv_[i] = std::move(kv_[j]);
+        }
+
+        // trivial pairs need no destruction, the metadata (tail included) is reset at once
+        void clear() noexcept {
+            if constexpr (!std::is_trivially_destructible<KvType>::value) {
+                for (size_t i = 0; i < size_; i++) {
+                    if (meta_[i]) {
+                        destroy(i);
+                    }
+                }
+            }
+            std::fill(meta_.begin(), meta_.end(), uint8_t(0));
+        }
+
+        // the pair is read only on a candidate match, but that's the common case for a hit
+        void prefetch(size_t i) const {
+            hash_map_detail::prefetch(meta_.data() + i);
+            hash_map_detail::prefetch(kv_ + i);
+        }
+
+    private:
+        // grabs the arrays of other, the allocators must be equal
+        void take(slots& other) noexcept {
+            meta_ = std::move(other.meta_);
+            hashes_ = std::move(other.hashes_);
+            kv_ = other.kv_;
+            size_ = other.size_;
+            other.meta_.clear();
+            other.hashes_.clear();
+            other.kv_ = nullptr;
+            other.size_ = 0;
+        }
+
+        // destroys the pairs and frees the arrays
+        void release() noexcept {
+            if (kv_) {
+                for (size_t i = 0; i < size_; i++) {
+                    if (meta_[i]) {
+                        destroy(i);
+                    }
+                }
+                KvTraits::deallocate(alloc_, kv_, size_);
+            }
+            meta_.clear();
+            hashes_.clear();
+            kv_ = nullptr;
+            size_ = 0;
+        }
+
+        MetaArray meta_;
+        HashArray hashes_;
+        KvAlloc alloc_;
+        KvType* kv_ = nullptr;
+        size_t size_ = 0;
+    };
+};
+
+/*
+ * Slots of pointers to pairs allocated one by one through Allocator: moving a pair between slots,
+ * growing or rehashing moves only the pointer, so references and pointers to elements stay valid
+ * until the element is erased (iterators don't, they are slot positions).
+ * A moved-from slot holds no pair. Nodes come from Allocator rebound to the pair, a pool
+ * allocator such as hash_map_pmr with std::pmr::unsynchronized_pool_resource packs them densely;
+ * tables over this storage are built and rehashed by one thread, so the pool needs no locking.
+ */
+struct StableStorage {
+    template <class KvType, bool StoreHash, class Allocator = std::allocator<KvType>> class slots {
+        using AllocTraits = std::allocator_traits<Allocator>;
+        using KvAlloc = typename AllocTraits::template rebind_alloc<KvType>;
+        using KvTraits = std::allocator_traits<KvAlloc>;
+        using MetaArray = std::vector<uint8_t, typename AllocTraits::template rebind_alloc<uint8_t>>;
+        using HashArray = std::vector<size_t, typename AllocTraits::template rebind_alloc<size_t>>;
+        using NodeArray = std::vector<KvType*, typename AllocTraits::template rebind_alloc<KvType*>>;
+
+    public:
+        static constexpr bool kGroupProbing = true;
+        static constexpr bool kStableElements = true;
+        static constexpr bool kStoresPsl = true;
+
+        explicit slots(size_t size = 0, const Allocator& alloc = Allocator())
+            : meta_(size ? size + hash_map_detail::MetaGroup::kWidth - 1 : 0, 0, alloc),
+              hashes_(StoreHash ? size : 0, 0, alloc), nodes_(size, nullptr, alloc), alloc_(alloc), size_(size) {}
+
+        slots(const slots& other, const Allocator& alloc) : slots(other.size_, alloc) {
+            for (size_t i = 0; i < size_; i++) {
+                if (other.meta(i)) {
+                    construct(i, other.kv(i));
+                    set_hash(i, other.hash(i));
+                    set_meta(i, other.meta(i));
+                }
+            }
+        }
+
+        slots(const slots& other)
+            : slots(other, AllocTraits::select_on_container_copy_construction(other.get_allocator())) {}
+
+        slots(slots&& other) noexcept
+            : meta_(std::move(other.meta_)), hashes_(std::move(other.hashes_)), nodes_(std::move(other.nodes_)),
+              alloc_(other.alloc_), size_(other.size_) {
+            other.meta_.clear();
+            other.hashes_.clear();
+            other.nodes_.clear();
+            other.size_ = 0;
+        }
+
+        slots(slots&& other, const Allocator& alloc) : meta_(alloc), hashes_(alloc), nodes_(alloc), alloc_(alloc) {
+            if (alloc_ == other.alloc_) {
+                take(other);
+                return;
+            }
+            slots moved(other.size_, alloc);
+            for (size_t i = 0; i < other.size_; i++) {
+                if (other.meta(i)) {
+                    moved.construct(i, std::move(other.kv(i)));
+                    moved.set_hash(i, other.hash(i));
+                    moved.set_meta(i, other.meta(i));
+                }
+            }
+            take(moved);
+            other.release();
+        }
+
+        slots& operator = (const slots& other) {
+            if (this != &other) {
+                if constexpr (AllocTraits::propagate_on_container_copy_assignment::value) {
+                    slots copy(other, other.get_allocator());
+                    release();
+                    alloc_ = copy.alloc_;
+                    take(copy);
+                } else {
+                    slots copy(other, get_allocator());
+                    release();
+                    take(copy);
+                }
+            }
+            return *this;
+        }
+
+        slots& operator = (slots&& other) noexcept(AllocTraits::propagate_on_container_move_assignment::value ||
+                                                   AllocTraits::is_always_equal::value) {
+            if (this != &other) {
+                if constexpr (AllocTraits::propagate_on_container_move_assignment::value) {
+                    release();
+                    alloc_ = other.alloc_;
+                    take(other);
+                } else {
+                    slots moved(std::move(other), get_allocator());
+                    release();
+                    take(moved);
+                }
+            }
+            return *this;
+        }
+
+        ~slots() {
+            release();
+        }
+
+        void swap(slots& other) noexcept {
+            if constexpr (AllocTraits::propagate_on_container_swap::value) {
+                std::swap(alloc_, other.alloc_);
+            }
+            meta_.swap(other.meta_);
+            hashes_.swap(other.hashes_);
+            nodes_.swap(other.nodes_);
+            std::swap(size_, other.size_);
+        }
+
+        Allocator get_allocator() const {
+            return Allocator(alloc_);
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+        uint8_t meta(size_t i) const {
+            return meta_[i];
+        }
+
+        void set_meta(size_t i, uint8_t meta) {
+            meta_[i] = meta;
+            // keep the mirrored tail in sync
+            for (size_t j = i + size_; j < meta_.size(); j += size_) {
+                meta_[j] = meta;
+            }
+        }
+
+        const uint8_t* meta_data() const {
+            return meta_.data();
+        }
+
+        size_t hash(size_t i) const {
+            return StoreHash ? hashes_[i] : 0;
+        }
+
+        void set_hash(size_t i, size_t hash) {
+            if (StoreHash) {
+                hashes_[i] = hash;
+            }
+        }
+
+        KvType& kv(size_t i) {
+            return *nodes_[i];
+        }
+
+        const KvType& kv(size_t i) const {
+            return *nodes_[i];
+        }
+
+        template <class... Args> void construct(size_t i, Args&&... args) {
+            KvType* node = KvTraits::allocate(alloc_, 1);
+            try {
+                new (node) KvType(std::forward<Args>(args)...);
+            } catch (...) {
+                KvTraits::deallocate(alloc_, node, 1);
+                throw;
+            }
+            nodes_[i] = node;
+        }
+
+        void destroy(size_t i) {
+            if (nodes_[i]) {
+                nodes_[i]->~KvType();
+                KvTraits::deallocate(alloc_, nodes_[i], 1);
+                nodes_[i] = nullptr;
+            }
+        }
+
+        // the node is handed over, unless it belongs to an unequal allocator
+        void move_construct(size_t i, slots& source, size_t j) {
+            if (&source != this && !(alloc_ == source.alloc_)) {
+                construct(i, std::move(source.kv(j)));
+                return;
+            }
+            nodes_[i] = source.nodes_[j];
+            source.nodes_[j] = nullptr;
+        }
+
+        void move_assign(size_t i, size_t j) {
+            destroy(i);
+            nodes_[i] = nodes_[j];
+            nodes_[j] = nullptr;
+        }
+
+        void clear() noexcept {
+            for (size_t i = 0; i < size_; i++) {
+                if (meta_[i]) {
+                    destroy(i);
+                }
+            }
+            std::fill(meta_.begin(), meta_.end(), uint8_t(0));
+        }
+
+        void prefetch(size_t i) const {
+            hash_map_detail::prefetch(meta_.data() + i);
+            hash_map_detail::prefetch(nodes_.data() + i);
+        }
+
+    private:
+        // grabs the arrays of other, the allocators must be equal
+        void take(slots& other) noexcept {
+            meta_ = std::move(other.meta_);
+            hashes_ = std::move(other.hashes_);
+            nodes_ = std::move(other.nodes_);
+            size_ = other.size_;
+            other.meta_.clear();
+            other.hashes_.clear();
+            other.nodes_.clear();
+            other.size_ = 0;
+        }
+
+        // destroys the pairs and frees the arrays
+        void release() noexcept {
+            for (size_t i = 0; i < size_; i++) {
+                if (meta_[i]) {
+                    destroy(i);
+                }
+            }
+            meta_.clear();
+            hashes_.clear();
+            nodes_.clear();
+            size_ = 0;
+        }
+
+        MetaArray meta_;
+        HashArray hashes_;
+        NodeArray nodes_;
+        KvAlloc alloc_;
+        size_t size_ = 0;
+    };
+};
+namespace hash_map_detail {
+
+// the key of a stored map pair or set key
+template <class Key> Key& slot_key(Key& key) {
+    return key;
+}
+
+template <class Key, class Value> Key& slot_key(std::pair<Key, Value>& keyvalue) {
+    return keyvalue.first;
+}
+
+template <class Key> const Key& slot_key(const Key& key) {
+    return key;
+}
+
+template <class Key, class Value> const Key& slot_key(const std::pair<Key, Value>& keyvalue) {
+    return keyvalue.first;
+}
+
+} // namespace hash_map_detail
+
+/*
+ * Slots that are the bare pairs (plus the hash with StoreHash): an empty slot holds EmptyKey,
+ * so there is no metadata and emptiness is one compare of the key. PSLs are recomputed from
+ * the hash, which is cheap for integer keys. Pairs must be trivially destructible and EmptyKey
+ * itself can't be inserted: that throws std::invalid_argument before the table grows
+ * (insert_batch checks the whole batch first), so the map is left unchanged.
+ */
+template <auto EmptyKey> struct SentinelStorage {
+    template <class KvType, bool StoreHash, class Allocator = std::allocator<KvType>> class slots {
+        using AllocTraits = std::allocator_traits<Allocator>;
+        using Key = std::remove_reference_t<decltype(hash_map_detail::slot_key(std::declval<KvType&>()))>;
+        static_assert(std::is_trivially_destructible<KvType>::value, "sentinel slots never destroy their pairs");
+
+    public:
+        static constexpr bool kGroupProbing = false;
+        static constexpr bool kStableElements = false;
+        static constexpr bool kStoresPsl = false;
+        static constexpr Key kEmptyKey = static_cast<Key>(EmptyKey);
+
+        explicit slots(size_t size = 0, const Allocator& alloc = Allocator()) : alloc_(alloc), size_(size) {
+            if (size_) {
+                nodes_ = NodeTraits::allocate(alloc_, size_);
+                for (size_t i = 0; i < size_; i++) {
+                    new (nodes_ + i) Node();
+                    hash_map_detail::slot_key(nodes_[i].keyvalue) = kEmptyKey;
+                }
+            }
+        }
+
+        slots(const slots& other, const Allocator& alloc) : alloc_(alloc), size_(other.size_) {
+            if (size_) {
+                nodes_ = NodeTraits::allocate(alloc_, size_);
+                std::uninitialized_copy(other.nodes_, other.nodes_ + size_, nodes_);
+            }
+        }
+
+        slots(const slots& other)
+            : slots(other, AllocTraits::select_on_container_copy_construction(other.get_allocator())) {}
+
+        slots(slots&& other) noexcept : alloc_(other.alloc_) {
+            take(other);
+        }
+
+        // plain pairs, a copy is as good as a move
+        slots(slots&& other, const Allocator& alloc) : alloc_(alloc) {
+            if (alloc_ == other.alloc_) {
+                take(other);
+                return;
+            }
+            slots moved(other, alloc);
+            take(moved);
+            other.release();
+        }
+
+        slots& operator = (const slots& other) {
+            if (this != &other) {
+                if constexpr (AllocTraits::propagate_on_container_copy_assignment::value) {
+                    slots copy(other, other.get_allocator());
+                    release();
+                    alloc_ = copy.alloc_;
+                    take(copy);
+                } else {
+                    slots copy(other, get_allocator());
+                    release();
+                    take(copy);
+                }
+            }
+            return *this;
+        }
+
+        slots& operator = (slots&& other) noexcept(AllocTraits::propagate_on_container_move_assignment::value ||
+                                                   AllocTraits::is_always_equal::value) {
+            if (this != &other) {
+                if constexpr (AllocTraits::propagate_on_container_move_assignment::value) {
+                    release();
+                    alloc_ = other.alloc_;
+                    take(other);
+                } else {
+                    slots moved(std::move(other), get_allocator());
+                    release();
+                    take(moved);
+                }
+            }
+            return *this;
+        }
+
+        ~slots() {
+            release();
+        }
+
+        void swap(slots& other) noexcept {
+            if constexpr (AllocTraits::propagate_on_container_swap::value) {
+                std::swap(alloc_, other.alloc_);
+            }
+            std::swap(nodes_, other.nodes_);
+            std::swap(size_, other.size_);
+        }
+
+        Allocator get_allocator() const {
+            return Allocator(alloc_);
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+        uint8_t meta(size_t i) const {
+            return hash_map_detail::slot_key(nodes_[i].keyvalue) == kEmptyKey ? 0 : 0xFF;
+        }
+
+        void set_meta(size_t i, uint8_t meta) {
+            if (!meta) {
+                hash_map_detail::slot_key(nodes_[i].keyvalue) = kEmptyKey;
+            }
+        }
+
+        size_t hash(size_t i) const {
+            return nodes_[i].get_hash();
+        }
+
+        void set_hash(size_t i, size_t hash) {
+            nodes_[i].set_hash(hash);
+        }
+
+        KvType& kv(size_t i) {
+            return nodes_[i].keyvalue;
+        }
+
+        const KvType& kv(size_t i) const {
+            return nodes_[i].keyvalue;
+        }
+
+        // a pair with the empty key would look like a free slot
+        template <class... Args> void construct(size_t i, Args&&... args) {
+            KvType keyvalue(std::forward<Args>(args)...);
+            if (hash_map_detail::slot_key(keyvalue) == kEmptyKey) {
+                throw std::invalid_argument("the empty key of SentinelStorage can't be inserted");
+            }
+            nodes_[i].keyvalue = keyvalue;
+        }
+
+        void destroy(size_t) {}
+
+        void move_construct(size_t i, slots& source, size_t j) {
+            nodes_[i].keyvalue = source.nodes_[j].keyvalue;
+        }
+
+        void move_assign(size_t i, size_t j) {
+            nodes_[i].keyvalue = nodes_[j].keyvalue;
+        }
+
+        void clear() noexcept {
+            for (size_t i = 0; i < size_; i++) {
+                hash_map_detail::slot_key(nodes_[i].keyvalue) = kEmptyKey;
+            }
+        }
+
+        void prefetch(size_t i) const {
+            hash_map_detail::prefetch(nodes_ + i);
+        }
+
+    private:
+        struct Node : hash_map_detail::StoredHash<StoreHash> {
+            KvType keyvalue{};
+        };
+
+        using NodeAlloc = typename AllocTraits::template rebind_alloc<Node>;
+        using NodeTraits = std::allocator_traits<NodeAlloc>;
+
+        // grabs the array of other, the allocators must be equal
+        void take(slots& other) noexcept {
+            nodes_ = other.nodes_;
+            size_ = other.size_;
+            other.nodes_ = nullptr;
+            other.size_ = 0;
+        }
+
+        void release() noexcept {
+            if (nodes_) {
+                NodeTraits::deallocate(alloc_, nodes_, size_);
+            }
+            nodes_ = nullptr;
+            size_ = 0;
+        }
+
+        NodeAlloc alloc_;
+        Node* nodes_ = nullptr;
+        size_t size_ = 0;
+    };
+};
+
+template <class KeyType, class ValueType, class Hash, class Equal, class Storage, bool StoreHash, class Allocator>
+class IncrementalHashMap;
+
+template <class KeyType, class ValueType, class Hash, class Equal, size_t Segments>
+class ConcurrentHashMap;
+
+namespace hash_map_detail {
+struct SnapshotAccess;
+} // namespace hash_map_detail
+
+// keys that are expensive to hash or compare get their hash cached in the slot by default
+template <class KeyType> struct default_store_hash
+    : std::integral_constant<bool, !std::is_trivially_copyable<KeyType>::value> {};
+
+/*
+ * Occupancy and probing of a table, returned by stats() of HashMap and HashSet.
+ *
+ * psl_histogram[d] is the number of elements d slots away from their ideal slot; a bad hash
+ * function shows up as a long histogram tail and a mean PSL far above 1.
+ * Deletion shifts elements back, so there are never tombstones.
+ * The probe counters count slots probed by lookups (find, count, contains, at, erase) and by
+ * inserts (try_emplace, insert, operator[] ...) and are zero unless the program is built with
+ * HASH_MAP_STATS. The macro adds the counters to every table, so it must be defined in all
+ * translation units or in none; concurrent const lookups on one table race on the counters.
+ */
+struct HashMapStats {
+    size_t capacity = 0;
+    size_t size = 0;
+    size_t tombstones = 0;
+    double load_factor = 0;
+    double max_load_factor = 0;
+    std::vector<size_t> psl_histogram;
+    size_t max_psl = 0;
+    double mean_psl = 0;
+    // rehashes of every kind: growth, reserve, rehash
+    size_t rehashes = 0;
+    double rehash_seconds = 0;
+    uint64_t lookups = 0;
+    uint64_t lookup_probes = 0;
+    uint64_t inserts = 0;
+    uint64_t insert_probes = 0;
+};
+
+namespace hash_map_detail {
+
+// what a table stores: Element in the slots and value_type seen through iterators;
+// key() gives the key of either, visit() passes an element to a for_each callback
+template <class Key, class Value> struct MapElement {
+    using KeyType = Key;
+    using Element = std::pair<Key, Value>;
+    using value_type = std::pair<const Key, Value>;
+
+    template <class Pair> static const Key& key(const Pair& keyvalue) {
+        return keyvalue.first;
+    }
+
+    template <class Pair, class F> static void visit(Pair& keyvalue, F& f) {
+        f(static_cast<const Key&>(keyvalue.first), keyvalue.second);
+    }
+};
+
+// bare keys, iterators give them as const
+template <class Key> struct SetElement {
+    using KeyType = Key;
+    using Element = Key;
+    using value_type = const Key;
+
+    static const Key& key(const Key& element) {
+        return element;
+    }
+
+    template <class F> static void visit(const Key& element, F& f) {
+        f(element);
+    }
+};
+
+} // namespace hash_map_detail
+
+/*
+ * The Robin Hood engine shared by HashMap and HashSet: probing, insertion, deletion and
+ * resizing over slots of Policy::Element (see MapElement and SetElement).
+ *
+ * Lookups (find, count, contains, at, erase) accept any key type K when both Hash and Equal
+ * define `is_transparent`, like C++20 unordered_map, so no temporary KeyType is built.
+ *
+ * With StoreHash every slot caches the mixed hash of its key: rehash doesn't call the hasher
+ * and lookups compare keys only for slots with an equal hash.
+ *
+ * The slot array is allocated through Allocator (rebound by the storage), it is kept
+ * by resize, rehash and clear and propagated on copy like in the standard containers.
+ * A new map has no buckets and allocates nothing until the first insertion.
+ */
+template <class Policy, class Hash, class Equal, class Storage, bool StoreHash, class Allocator>
+class RobinHoodTable {
+
+public:
+    using KeyType = typename Policy::KeyType;
+    using KvType = typename Policy::Element;
+    using value_type = typename Policy::value_type;
+    using allocator_type = Allocator;
+    // slot metadata packs occupancy and PSL into one byte: kEmpty - free slot, otherwise PSL + 1.
+    // PSLs that do not fit are stored as kSaturated and recomputed from the hash
+    static constexpr uint8_t kEmpty = 0;
+    static constexpr uint8_t kSaturated = 0xFF;
+
+    using Slots = typename Storage::template slots<KvType, StoreHash, Allocator>;
+
+    // define hash map iterators
+    template <typename ContT, typename IterVal> struct hm_iterator {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::remove_const_t<IterVal>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = IterVal*;
+        using reference = IterVal&;
+
+        explicit hm_iterator() : hm_(nullptr) {}
+
+        explicit hm_iterator(ContT *hm) : hm_(hm) { advance_past_empty(); }
+
+        explicit hm_iterator(ContT *hm, size_t idx) : hm_(hm), idx_(idx) {}
+
+        template <typename OtherContT, typename OtherIterVal>
+        explicit hm_iterator(const hm_iterator<OtherContT, OtherIterVal> &other): hm_(other.hm_), idx_(other.idx_) {}
+
+        bool operator==(const hm_iterator &other) const {
+            return other.hm_ == hm_ && other.idx_ == idx_;
+        }
+        bool operator!=(const hm_iterator &other) const {
+            return !(other == *this);
+        }
+
+        hm_iterator &operator++() {
+            ++idx_;
+            advance_past_empty();
+            return *this;
+        }
+
+        hm_iterator operator++(int) {
+            auto tmp = *this;
+            ++idx_;
+            advance_past_empty();
+            return tmp;
+        }
+        
+
+        IterVal& operator*() {
+            return *get_cur_pointer();
+        }
+
+        IterVal* operator->() {
+              return get_cur_pointer();
+        }
+
+    private:
+        void advance_past_empty() {
+            idx_ = hm_->next_alive(idx_);
+        }
+
+        auto get_cur_pointer() {
+            // casting the stored element to value_type, e.g. std::pair<KeyType, ValueType>
+            // to std::pair<const KeyType, ValueType>
+            return reinterpret_cast<IterVal*> (&(hm_->data_.kv(idx_)));
+        }
+
+        ContT *hm_ = nullptr;
+        size_t idx_ = 0;
+        friend ContT;
+    };
+
+    using iterator = hm_iterator<RobinHoodTable, value_type>;
+    using const_iterator = hm_iterator<const RobinHoodTable, const value_type>;
+    
+    // constructors
+    explicit RobinHoodTable(Hash hasher_ = Hash(), Equal key_equal_ = Equal(), const Allocator& alloc = Allocator())
+        : hasher_(std::move(hasher_)), key_equal_(std::move(key_equal_)), data_(0, alloc) {}
+
+    explicit RobinHoodTable(const Allocator& alloc) : RobinHoodTable(Hash(), Equal(), alloc) {}
+
+    // pre-sized for `capacity` elements
+    explicit RobinHoodTable(size_t capacity, Hash hasher_ = Hash(), Equal key_equal_ = Equal(),
+                     const Allocator& alloc = Allocator())
+        : RobinHoodTable(std::move(hasher_), std::move(key_equal_), alloc){
+        reserve(capacity);
+    }
+
+    RobinHoodTable(const RobinHoodTable& other)
+        : hasher_(other.hasher_), key_equal_(other.key_equal_), data_(other.data_), load_factor_(other.load_factor_),
+          cnt_all_(other.cnt_all_), buffer_size_(other.buffer_size_), max_psl_(other.max_psl_),
+          build_threads_(other.build_threads_), counters_(other.counters_) {}
+
+    // copy placed into `alloc`
+    RobinHoodTable(const RobinHoodTable& other, const Allocator& alloc)
+        : hasher_(other.hasher_), key_equal_(other.key_equal_), data_(other.data_, alloc),
+          load_factor_(other.load_factor_), cnt_all_(other.cnt_all_), buffer_size_(other.buffer_size_),
+          max_psl_(other.max_psl_), build_threads_(other.build_threads_), counters_(other.counters_) {}
+
+    // moved from map is left empty, without any buckets
+    RobinHoodTable(RobinHoodTable&& other) noexcept(std::is_nothrow_move_constructible<Hash>::value &&
+                                      std::is_nothrow_move_constructible<Equal>::value)
+        : hasher_(std::move(other.hasher_)), key_equal_(std::move(other.key_equal_)),
+          data_(std::move(other.data_)), load_factor_(other.load_factor_),
+          cnt_all_(other.cnt_all_), buffer_size_(other.buffer_size_), max_psl_(other.max_psl_),
+          build_threads_(other.build_threads_), counters_(other.counters_) {
+        other.cnt_all_ = 0;
+        other.buffer_size_ = 0;
+        other.max_psl_ = 0;
+    }
+
+    RobinHoodTable& operator = (const RobinHoodTable& other) {
+        if (this != &other) {
+            Hash hasher_2(other.hasher_);
+            Equal key_equal_2(other.key_equal_);
+            data_ = other.data_;
+            hasher_ = std::move(hasher_2);
+            key_equal_ = std::move(key_equal_2);
+            load_factor_ = other.load_factor_;
+            cnt_all_ = other.cnt_all_;
+            buffer_size_ = other.buffer_size_;
+            max_psl_ = other.max_psl_;
+            build_threads_ = other.build_threads_;
+            counters_ = other.counters_;
+        }
+        return *this;
+    }
+
+    RobinHoodTable& operator = (RobinHoodTable&& other) noexcept(std::is_nothrow_move_assignable<Hash>::value &&
+                                                   std::is_nothrow_move_assignable<Equal>::value &&
+                                                   std::is_nothrow_move_assignable<Slots>::value) {
+        if (this != &other) {
+            hasher_ = std::move(other.hasher_);
+            key_equal_ = std::move(other.key_equal_);
+            data_ = std::move(other.data_);
+            load_factor_ = other.load_factor_;
+            cnt_all_ = other.cnt_all_;
+            buffer_size_ = other.buffer_size_;
+            max_psl_ = other.max_psl_;
+            build_threads_ = other.build_threads_;
+            counters_ = other.counters_;
+            other.cnt_all_ = 0;
+            other.buffer_size_ = 0;
+            other.max_psl_ = 0;
+        }
+        return *this;
+    }
+
+    // range constructors reserve for the range length (or `capacity`, if it's larger);
+    // large ranges are placed by `threads` threads (0 - hardware concurrency), see build_threads()
+    RobinHoodTable(KvType* start, KvType* end, size_t capacity = 0, size_t threads = 0) : RobinHoodTable(){
+        build_threads_ = threads;
+        reserve(std::max<size_t>(capacity, end - start));
+        build(end - start, false, [&](size_t i) -> const KvType& { return start[i]; });
+    }
+
+    RobinHoodTable(iterator begin, iterator end, size_t capacity = 0, size_t threads = 0): RobinHoodTable(){
+        build_threads_ = threads;
+        std::vector<iterator> items;
+        for (iterator cur = begin; cur != end; ++cur) {
+            items.push_back(cur);
+        }
+        reserve(std::max<size_t>(capacity, items.size()));
+        build(items.size(), true, [&](size_t i) -> const auto& { return *items[i]; });
+    }
+
+    RobinHoodTable(const_iterator begin, const_iterator end, size_t capacity = 0, size_t threads = 0): RobinHoodTable(){
+        build_threads_ = threads;
+        std::vector<const_iterator> items;
+        for (const_iterator cur = begin; cur != end; ++cur) {
+            items.push_back(cur);
+        }
+        reserve(std::max<size_t>(capacity, items.size()));
+        build(items.size(), true, [&](size_t i) -> const auto& { return *items[i]; });
+    }
+
+    RobinHoodTable(std::initializer_list<KvType> list, size_t capacity = 0, size_t threads = 0): RobinHoodTable(){
+        build_threads_ = threads;
+        reserve(std::max(capacity, list.size()));
+        build(list.size(), false, [&](size_t i) -> const KvType& { return list.begin()[i]; });
+    }
+
+    // simple functions
+    size_t size() const {
+        return cnt_all_;
+    }
+
+    bool empty() const {
+        return cnt_all_ == 0;
+    }
+
+    size_t bucket_count() const {
+        return buffer_size_;
+    }
+
+    // no element is farther than max_psl() from its ideal slot, so a lookup probes at most
+    // max_psl() + 1 slots; erasures don't lower it until the next rehash
+    size_t max_psl() const {
+        return max_psl_;
+    }
+
+    // walks the whole table, see HashMapStats
+    HashMapStats stats() const {
+        HashMapStats result;
+        result.capacity = buffer_size_;
+        result.size = cnt_all_;
+        result.load_factor = buffer_size_ ? static_cast<double>(cnt_all_) / buffer_size_ : 0;
+        result.max_load_factor = load_factor_;
+        size_t total_psl = 0;
+        for (size_t i = 0; i < buffer_size_; i++) {
+            if (data_.meta(i) == kEmpty) {
+                continue;
+            }
+            size_t dist = get_dist(i);
+            if (dist >= result.psl_histogram.size()) {
+                result.psl_histogram.resize(dist + 1);
+            }
+            result.psl_histogram[dist]++;
+            result.max_psl = std::max(result.max_psl, dist);
+            total_psl += dist;
+        }
+        result.mean_psl = cnt_all_ ? static_cast<double>(total_psl) / cnt_all_ : 0;
+        result.rehashes = counters_.rehashes;
+        result.rehash_seconds = counters_.rehash_seconds;
+#if defined(HASH_MAP_STATS)
+        result.lookups = counters_.lookups;
+        result.lookup_probes = counters_.lookup_probes;
+        result.inserts = counters_.inserts;
+        result.insert_probes = counters_.insert_probes;
+#endif
+        return result;
+    }
+
+    // zeroes the rehash and probe counters, e.g. after exporting them
+    void reset_stats() {
+        counters_ = hash_map_detail::Counters();
+    }
+
+    Hash hash_function() const {
+        return hasher_;
+    }
+
+    Equal key_eq() const {
+        return key_equal_;
+    }
+
+    Allocator get_allocator() const {
+        return data_.get_allocator();
+    }
+
+    double load_factor() const {
+        return buffer_size_ ? static_cast<double>(cnt_all_) / buffer_size_ : 0;
+    }
+
+    double max_load_factor() const {
+        return load_factor_;
+    }
+
+    // the table grows once size() would exceed bucket_count() * max_load_factor()
+    void max_load_factor(double load_factor) {
+        if (!(load_factor > 0 && load_factor < 1)) {
+            throw std::invalid_argument("max load factor must be in (0, 1)");
+        }
+        load_factor_ = load_factor;
+        if (cnt_all_ > buffer_size_ * load_factor_) {
+            rehash_to(min_buckets(cnt_all_));
+        }
+    }
+
+    // makes room for `count` elements without further growth
+    void reserve(size_t count) {
+        size_t buckets = min_buckets(count);
+        if (count && buckets > buffer_size_) {
+            rehash_to(buckets);
+        }
+    }
+
+    // threads used to place the elements of large range constructions and rehashes,
+    // 0 - std::thread::hardware_concurrency(); tables under kParallelBuildThreshold elements
+    // are always built serially
+    size_t build_threads() const {
+        return build_threads_;
+    }
+
+    void build_threads(size_t threads) {
+        build_threads_ = threads;
+    }
+
+    // rebuilds the table with at least `buckets` slots, enough to hold size() elements
+    void rehash(size_t buckets) {
+        size_t new_size = std::max(min_buckets(cnt_all_), default_size_);
+        while (new_size < buckets) {
+            new_size *= 2;
+        }
+        if (new_size != buffer_size_) {
+            rehash_to(new_size);
+        }
+    }
+
+    iterator begin() {
+        return iterator(this);
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this);
+    }
+
+    iterator end() {
+        return iterator(this, data_.size());
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, data_.size());
+    }
+
+    // not such simple functions
+    // builds the element from args; it's dropped if the key is already present
+    template <class... Args> std::pair<iterator, bool> emplace(Args&&... args) {
+        KvType keyvalue(std::forward<Args>(args)...);
+        ProbeResult probe = probe_key(Policy::key(keyvalue));
+        if (probe.found) {
+            return {iterator(this, probe.index), false};
+        }
+        check_insertable(Policy::key(keyvalue));
+        if (resize()) {
+            probe = insert_point(probe.hash);
+        }
+        return {iterator(this, emplace_at(probe, std::move(keyvalue))), true};
+    }
+
+    void erase(const KeyType& key) {
+        erase_key(key);
+    }
+
+    template <class K, class H = Hash, class E = Equal, hash_map_detail::enable_transparent<H, E> = 0>
+    void erase(const K& key) {
+        erase_key(key);
+    }
+
+    iterator find(const KeyType& key) {
+        return iterator(this, find_index(key));
+    }
+
+    const_iterator find(const KeyType& key) const {
+        return const_iterator(this, find_index(key));
+    }
+
+    template <class K, class H = Hash, class E = Equal, hash_map_detail::enable_transparent<H, E> = 0>
+    iterator find(const K& key) {
+        return iterator(this, find_index(key));
+    }
+
+    template <class K, class H = Hash, class E = Equal, hash_map_detail::enable_transparent<H, E> = 0>
+    const_iterator find(const K& key) const {
+        return const_iterator(this, find_index(key));
+    }
+
+    size_t count(const KeyType& key) const {
+        return find_index(key) != buffer_size_;
+    }
+
+    template <class K, class H = Hash, class E = Equal, hash_map_detail::enable_transparent<H, E> = 0>
+    size_t count(const K& key) const {
+        return find_index(key) != buffer_size_;
+    }
+
+    bool contains(const KeyType& key) const {
+        return find_index(key) != buffer_size_;
+    }
+
+    template <class K, class H = Hash, class E = Equal, hash_map_detail::enable_transparent<H, E> = 0>
+    bool contains(const K& key) const {
+        return find_index(key) != buffer_size_;
+    }
+
+    // a lookup split in two: prefetch(key) hashes the key and prefetches its home slot,
+    // resolve(lookup) probes later and returns what find(key) returns at that time.
+    // Interleaving many prefetches and resolves, across any number of tables, overlaps their
+    // cache misses (AMAC style). The lookup points to the key, which must outlive it, so
+    // temporary keys are rejected; it stays valid across modifications of the table, only
+    // the prefetch is lost then
+    template <class K> struct PendingLookup {
+        const K* key;
+        size_t hash;
+    };
+
+    PendingLookup<KeyType> prefetch(const KeyType& key) const {
+        return prefetch_key(key);
+    }
+
+    PendingLookup<KeyType> prefetch(const KeyType&& key) const = delete;
+
+    template <class K, class H = Hash, class E = Equal, hash_map_detail::enable_transparent<H, E> = 0>
+    PendingLookup<K> prefetch(const K& key) const {
+        return prefetch_key(key);
+    }
+
+    template <class K, class H = Hash, class E = Equal, hash_map_detail::enable_transparent<H, E> = 0>
+    PendingLookup<K> prefetch(const K&& key) const = delete;
+
+    template <class K> iterator resolve(const PendingLookup<K>& lookup) {
+        return iterator(this, find_index(*lookup.key, lookup.hash));
+    }
+
+    template <class K> const_iterator resolve(const PendingLookup<K>& lookup) const {
+        return const_iterator(this, find_index(*lookup.key, lookup.hash));
+    }
+
+    // batched operations give the same results as calling find / contains / insert for each
+    // key in order, but hash a chunk of keys and prefetch their home slots before probing any,
+    // so the cache misses of a chunk overlap instead of following one another
+    void find_batch(const KeyType* keys, size_t n, iterator* out) {
+        size_t hashes[kBatchChunk];
+        for (size_t start = 0; start < n; start += kBatchChunk) {
+            size_t len = std::min(kBatchChunk, n - start);
+            hash_and_prefetch(keys + start, len, hashes);
+            for (size_t i = 0; i < len; i++) {
+                out[start + i] = iterator(this, find_index(keys[start + i], hashes[i]));
+            }
+        }
+    }
+
+    void find_batch(const KeyType* keys, size_t n, const_iterator* out) const {
+        size_t hashes[kBatchChunk];
+        for (size_t start = 0; start < n; start += kBatchChunk) {
+            size_t len = std::min(kBatchChunk, n - start);
+            hash_and_prefetch(keys + start, len, hashes);
+            for (size_t i = 0; i < len; i++) {
+                out[start + i] = const_iterator(this, find_index(keys[start + i], hashes[i]));
+            }
+        }
+    }
+
+    void contains_batch(const KeyType* keys, size_t n, bool* out) const {
+        size_t hashes[kBatchChunk];
+        for (size_t start = 0; start < n; start += kBatchChunk) {
+            size_t len = std::min(kBatchChunk, n - start);
+            hash_and_prefetch(keys + start, len, hashes);
+            for (size_t i = 0; i < len; i++) {
+                out[start + i] = find_index(keys[start + i], hashes[i]) != buffer_size_;
+            }
+        }
+    }
+
+    // returns the number of inserted elements; a key repeated in the batch keeps its first value.
+    // A batch holding the empty key of SentinelStorage throws before inserting anything
+    size_t insert_batch(const KvType* keyvalues, size_t n) {
+        if constexpr (hash_map_detail::has_empty_key<Slots>::value) {
+            for (size_t i = 0; i < n; i++) {
+                check_insertable(Policy::key(keyvalues[i]));
+            }
+        }
+        size_t hashes[kBatchChunk];
+        size_t inserted = 0;
+        for (size_t start = 0; start < n; start += kBatchChunk) {
+            size_t len = std::min(kBatchChunk, n - start);
+            // grow before prefetching, so the chunk doesn't move the slots
+            reserve(cnt_all_ + len);
+            for (size_t i = 0; i < len; i++) {
+                hashes[i] = full_hash(Policy::key(keyvalues[start + i]));
+                data_.prefetch(hashes[i] & (buffer_size_ - 1));
+            }
+            for (size_t i = 0; i < len; i++) {
+                ProbeResult probe = probe_key(Policy::key(keyvalues[start + i]), hashes[i]);
+                if (!probe.found) {
+                    emplace_at(probe, keyvalues[start + i]);
+                    inserted++;
+                }
+            }
+        }
+        return inserted;
+    }
+
+    // moves in the elements of other whose keys are absent here and returns their number;
+    // other is left empty, keeping its buckets for the next delta. Room for both tables is
+    // reserved up front and other is walked in slot order, so with a stateless Hash (hashing
+    // alike in both tables, stored hashes are reused) the insertion points advance through
+    // this table in hash order too. If moving an element throws, the rest of other is dropped
+    size_t merge(RobinHoodTable&& other) {
+        return merge_impl(other, [](KvType&, KvType&) {});
+    }
+
+    // calls f(key, value) (f(key) in a set) for every element in slot order, skipping empty
+    // slots a metadata group at a time where the storage allows it
+    template <class F> void for_each(F&& f) {
+        visit_range(*this, 0, buffer_size_, f);
+    }
+
+    template <class F> void for_each(F&& f) const {
+        visit_range(*this, 0, buffer_size_, f);
+    }
+
+    // for_each over the chunk-th of `chunks` contiguous slot ranges; distinct chunks may be
+    // visited from different threads at once, e.g. thread t of n calls for_each_chunk(t, n, f)
+    template <class F> void for_each_chunk(size_t chunk, size_t chunks, F&& f) {
+        visit_range(*this, chunk_begin(chunk, chunks), chunk_begin(chunk + 1, chunks), f);
+    }
+
+    template <class F> void for_each_chunk(size_t chunk, size_t chunks, F&& f) const {
+        visit_range(*this, chunk_begin(chunk, chunks), chunk_begin(chunk + 1, chunks), f);
+    }
+
+    // keeps the capacity, so refilling to the same size doesn't grow the table again
+    void clear() noexcept {
+        data_.clear();
+        cnt_all_ = 0;
+        max_psl_ = 0;
+    }
+
+    // rebuilds the table with the fewest buckets that hold size() elements,
+    // an empty map frees its buckets
+    void shrink_to_fit() {
+        if (cnt_all_ == 0) {
+            data_ = Slots(0, data_.get_allocator());
+            buffer_size_ = 0;
+            max_psl_ = 0;
+            return;
+        }
+        rehash(0);
+    }
+
+protected:
+    // single probe find-or-insert of key: a miss stops right at the Robin Hood insertion point
+    // and the element is constructed from element_args, which may refer to key or to elements
+    // of the table; only a miss that grows the table probes again
+    template <class K, class... ElementArgs>
+    std::pair<iterator, bool> find_or_construct(const K& key, ElementArgs&&... element_args) {
+        ProbeResult probe = probe_key(key);
+        if (probe.found) {
+            return {iterator(this, probe.index), false};
+        }
+        check_insertable(key);
+        if (cnt_all_ + 1 <= buffer_size_ * load_factor_ && data_.meta(probe.index) == kEmpty) {
+            // nothing is moved, the element is built right in the free slot
+            return {iterator(this, emplace_at(probe, std::forward<ElementArgs>(element_args)...)), true};
+        }
+        // growing or shifting the run moves elements, build the element before
+        KvType element(std::forward<ElementArgs>(element_args)...);
+        if (resize()) {
+            probe = insert_point(probe.hash);
+        }
+        return {iterator(this, emplace_at(probe, std::move(element))), true};
+    }
+
+    // the empty key of SentinelStorage is rejected before the table grows, so a failed
+    // insertion leaves the map unchanged
+    template <class K> void check_insertable(const K& key) const {
+        if constexpr (hash_map_detail::has_empty_key<Slots>::value) {
+            if (key == Slots::kEmptyKey) {
+                throw std::invalid_argument("the empty key of SentinelStorage can't be inserted");
+            }
+        }
+    }
+
+    // like find_index, but a missing key throws
+    template <class K> size_t at_index(const K& key) const {
+        size_t index = find_index(key);
+        if (index == buffer_size_) {
+            throw std::out_of_range("very sad:(");
+        }
+        return index;
+    }
+
+    // merge, on_duplicate(element, other_element) is called for the keys present in both tables
+    template <class OnDuplicate> size_t merge_impl(RobinHoodTable& other, OnDuplicate on_duplicate) {
+        if (&other == this) {
+            return 0;
+        }
+        reserve(cnt_all_ + other.cnt_all_);
+        size_t indices[kBatchChunk];
+        size_t hashes[kBatchChunk];
+        size_t merged = 0;
+        try {
+            size_t index = other.next_alive(0);
+            while (index != other.buffer_size_) {
+                size_t len = 0;
+                for (; len < kBatchChunk && index != other.buffer_size_; index = other.next_alive(index + 1)) {
+                    indices[len] = index;
+                    hashes[len] = std::is_empty<Hash>::value ? other.slot_hash(index)
+                                                             : full_hash(Policy::key(other.data_.kv(index)));
+                    prefetch_home(hashes[len]);
+                    len++;
+                }
+                for (size_t i = 0; i < len; i++) {
+                    KvType& element = other.data_.kv(indices[i]);
+                    ProbeResult probe = probe_key(Policy::key(element), hashes[i]);
+                    if (probe.found) {
+                        on_duplicate(data_.kv(probe.index), element);
+                    } else {
+                        emplace_at(probe, MovedSlot{&other.data_, indices[i]});
+                        merged++;
+                    }
+                }
+            }
+        } catch (...) {
+            other.clear();
+            throw;
+        }
+        other.clear();
+        return merged;
+    }
+
+    KvType& slot(size_t index) {
+        return data_.kv(index);
+    }
+
+    const KvType& slot(size_t index) const {
+        return data_.kv(index);
+    }
+
+private:
+    template <class, class, class, class, class, bool, class> friend class IncrementalHashMap;
+    template <class, class, class, class, size_t> friend class ConcurrentHashMap;
+    friend struct hash_map_detail::SnapshotAccess;
+
+    Hash hasher_;
+    Equal key_equal_;
+    Slots data_;
+    // buffer_size_ is always a power of two, slots are indexed by masking
+    size_t default_size_ = 16;
+    double load_factor_ = 0.5;
+    size_t cnt_all_ = 0;
+    size_t buffer_size_ = 0;
+    // no element is farther from its ideal slot; erasures leave it as an upper bound
+    size_t max_psl_ = 0;
+    // 0 means std::thread::hardware_concurrency()
+    size_t build_threads_ = 0;
+    mutable hash_map_detail::Counters counters_;
+    // bulk builds and rehashes of smaller tables stay serial
+    static constexpr size_t kParallelBuildThreshold = size_t(1) << 17;
+    static constexpr size_t kMinBuildRange = size_t(1) << 14;
+    // keys hashed and prefetched ahead by the batched operations
+    static constexpr size_t kBatchChunk = 16;
+
+
+    // mixed hash of the key, its low bits give the ideal slot
+    template <class K> size_t full_hash(const K& k) const {
+        return hash_map_detail::mix_hash(hasher_(k));
+    }
+
+    // mixed hash of the alive element stored at index
+    size_t slot_hash(size_t index) const {
+        if constexpr (StoreHash) {
+            return data_.hash(index);
+        }
+        return full_hash(Policy::key(data_.kv(index)));
+    }
+
+    // compares the alive element at index with a key of the given mixed hash
+    template <class K> bool slot_equals(size_t index, size_t hash, const K& key) const {
+        if constexpr (StoreHash) {
+            if (data_.hash(index) != hash) {
+                return false;
+            }
+        }
+        return key_equal_(Policy::key(data_.kv(index)), key);
+    }
+
+    bool is_alive(size_t index) const {
+        return data_.meta(index) != kEmpty;
+    }
+
+    // occupied slots among the group starting at index that are before end
+    uint64_t alive_in_group(size_t index, size_t end) const {
+        using hash_map_detail::MetaGroup;
+        uint64_t alive = MetaGroup::match_alive(data_.meta_data() + index);
+        // the mirrored tail past the last slot repeats the first ones
+        if (end - index < MetaGroup::kWidth) {
+            alive &= (uint64_t(1) << ((end - index) << MetaGroup::kShift)) - 1;
+        }
+        return alive;
+    }
+
+    // first alive slot at or after index, or buffer_size_
+    size_t next_alive(size_t index) const {
+        if constexpr (Slots::kGroupProbing) {
+            for (; index < buffer_size_; index += hash_map_detail::MetaGroup::kWidth) {
+                uint64_t alive = alive_in_group(index, buffer_size_);
+                if (alive) {
+                    return index + hash_map_detail::lowest_slot(alive);
+                }
+            }
+            return buffer_size_;
+        }
+        while (index < buffer_size_ && !is_alive(index)) {
+            index++;
+        }
+        return index;
+    }
+
+    size_t chunk_begin(size_t chunk, size_t chunks) const {
+        return chunk >= chunks ? buffer_size_ : buffer_size_ / chunks * chunk + std::min(chunk, buffer_size_ % chunks);
+    }
+
+    // calls f for the elements in slots [begin, end), Self is RobinHoodTable or const RobinHoodTable
+    template <class Self, class F> static void visit_range(Self& self, size_t begin, size_t end, F& f) {
+        if constexpr (Slots::kGroupProbing) {
+            for (size_t index = begin; index < end; index += hash_map_detail::MetaGroup::kWidth) {
+                uint64_t alive = self.alive_in_group(index, end);
+                while (alive) {
+                    Policy::visit(self.data_.kv(index + hash_map_detail::lowest_slot(alive)), f);
+                    alive &= alive - 1;
+                }
+            }
+            return;
+        }
+        for (size_t index = begin; index < end; index++) {
+            if (self.is_alive(index)) {
+                Policy::visit(self.data_.kv(index), f);
+            }
+        }
+    }
+
+    static uint8_t encode_dist(size_t dist) {
+        return dist + 1 < kSaturated ? static_cast<uint8_t>(dist + 1) : kSaturated;
+    }
+
+    // PSL of the alive element stored at index
+    size_t get_dist(size_t index) const {
+        uint8_t meta = data_.meta(index);
+        if (meta != kSaturated) {
+            return meta - 1;
+        }
+        return (index - slot_hash(index)) & (buffer_size_ - 1);
+    }
+
+    struct ProbeResult {
+        size_t index;
+        size_t dist;
+        size_t hash;
+        bool found;
+    };
+
+    // walks the key's probe sequence a metadata group at a time; when the key is absent
+    // returns the slot where Robin Hood insertion starts and the PSL it would have there.
+    // groups starting past max_dist aren't probed, lookups pass max_psl_ and get no insertion point
+    template <class K> ProbeResult group_probe(const K& key, size_t hash, size_t max_dist) const {
+        using hash_map_detail::MetaGroup;
+        size_t h1 = hash & (buffer_size_ - 1);
+        for (size_t dist = 0; dist < buffer_size_ && dist <= max_dist; dist += MetaGroup::kWidth) {
+            size_t index = (h1 + dist) & (buffer_size_ - 1);
+            hash_map_detail::GroupMask mask =
+                    MetaGroup::match_dist(data_.meta_data() + index, encode_dist(dist), kSaturated);
+            uint64_t match = mask.match;
+            if (mask.stop) {
+                // candidates behind the first stop can't hold the key
+                match &= (mask.stop & (~mask.stop + 1)) - 1;
+            }
+            while (match) {
+                size_t slot = (index + hash_map_detail::lowest_slot(match)) & (buffer_size_ - 1);
+                if (slot_equals(slot, hash, key)) {
+                    return {slot, 0, hash, true};
+                }
+                match &= match - 1;
+            }
+            if (mask.stop) {
+                size_t offset = hash_map_detail::lowest_slot(mask.stop);
+                return {(index + offset) & (buffer_size_ - 1), dist + offset, hash, false};
+            }
+        }
+        return {buffer_size_, 0, hash, false};
+    }
+
+    template <class K> ProbeResult probe_key(const K& key) const {
+        return probe_key(key, full_hash(key));
+    }
+
+    // like group_probe, for storages without group probing
+    template <class K> ProbeResult probe_key(const K& key, size_t hash) const {
+        if constexpr (Slots::kGroupProbing) {
+            ProbeResult probe = group_probe(key, hash, buffer_size_);
+            count_insert_probe(probed_slots(probe, buffer_size_));
+            return probe;
+        }
+        size_t h1 = hash & (buffer_size_ - 1);
+        for (size_t dist = 0; dist < buffer_size_; dist++) {
+            size_t index = (h1 + dist) & (buffer_size_ - 1);
+            if (data_.meta(index) == kEmpty || (Slots::kStoresPsl && get_dist(index) < dist)) {
+                count_insert_probe(dist + 1);
+                return {index, dist, hash, false};
+            }
+            if (slot_equals(index, hash, key)) {
+                count_insert_probe(dist + 1);
+                return {index, 0, hash, true};
+            }
+            // without stored PSLs the key is compared first, the PSL costs a hash
+            if (!Slots::kStoresPsl && get_dist(index) < dist) {
+                count_insert_probe(dist + 1);
+                return {index, dist, hash, false};
+            }
+        }
+        count_insert_probe(buffer_size_);
+        return {buffer_size_, 0, hash, false};
+    }
+
+    // counts a find-like (lookup) or insert-like probe of `slots` slots, see HashMapStats
+    void count_lookup_probe(size_t slots) const {
+#if defined(HASH_MAP_STATS)
+        counters_.lookups++;
+        counters_.lookup_probes += slots;
+#else
+        (void)slots;
+#endif
+    }
+
+    void count_insert_probe(size_t slots) const {
+#if defined(HASH_MAP_STATS)
+        counters_.inserts++;
+        counters_.insert_probes += slots;
+#else
+        (void)slots;
+#endif
+    }
+
+    // slots a group probe went through, up to the found key or the stop; probing of
+    // a whole bounded sequence is counted as max_dist + 1 slots
+    size_t probed_slots(const ProbeResult& probe, size_t max_dist) const {
+        if (probe.found) {
+            return ((probe.index - probe.hash) & (buffer_size_ - 1)) + 1;
+        }
+        return probe.index == buffer_size_ ? std::min(max_dist + 1, buffer_size_) : probe.dist + 1;
+    }
+
+    template <class K> void erase_key(const K& key) {
+        size_t index = find_index(key);
+        if (index != buffer_size_) {
+            erase_at(index);
+        }
+    }
+
+    // backward shift deletion: the elements following the erased one are moved one slot back
+    // until an empty slot or an element in its ideal slot, so no tombstones are left behind
+    void erase_at(size_t index) {
+        size_t next = (index + 1) & (buffer_size_ - 1);
+        while (data_.meta(next) != kEmpty) {
+            size_t next_dist = get_dist(next);
+            if (next_dist == 0) {
+                break;
+            }
+            data_.move_assign(index, next);
+            data_.set_hash(index, data_.hash(next));
+            data_.set_meta(index, encode_dist(next_dist - 1));
+            index = next;
+            next = (next + 1) & (buffer_size_ - 1);
+        }
+        data_.destroy(index);
+        data_.set_meta(index, kEmpty);
+        cnt_all_--;
+    }
+
+    // moves the alive element at index into target, which must not hold its key
+    // and must have room for it without growing
+    void move_slot_to(size_t index, RobinHoodTable& target) {
+        target.emplace_at(target.insert_point(slot_hash(index)), MovedSlot{&data_, index});
+        erase_at(index);
+    }
+
+    // hints the home slot of a mixed hash, if there are any slots
+    void prefetch_home(size_t hash) const {
+        if (buffer_size_) {
+            data_.prefetch(hash & (buffer_size_ - 1));
+        }
+    }
+
+    void hash_and_prefetch(const KeyType* keys, size_t len, size_t* hashes) const {
+        for (size_t i = 0; i < len; i++) {
+            hashes[i] = full_hash(keys[i]);
+            prefetch_home(hashes[i]);
+        }
+    }
+
+    template <class K> PendingLookup<K> prefetch_key(const K& key) const {
+        size_t hash = full_hash(key);
+        prefetch_home(hash);
+        return {&key, hash};
+    }
+
+    // slot index of the key or buffer_size_
+    template <class K> size_t find_index(const K& key) const {
+        return find_index(key, full_hash(key));
+    }
+
+    // no element is farther than max_psl_ from its ideal slot, and the key can't be behind
+    // a richer element
+    template <class K> size_t find_index(const K& key, size_t hash) const {
+        if constexpr (Slots::kGroupProbing) {
+            ProbeResult probe = group_probe(key, hash, max_psl_);
+            count_lookup_probe(probed_slots(probe, max_psl_));
+            return probe.found ? probe.index : buffer_size_;
+        }
+        size_t h1 = hash & (buffer_size_ - 1);
+        for (size_t dist = 0; dist <= max_psl_ && dist < buffer_size_; dist++) {
+            size_t index = (h1 + dist) & (buffer_size_ - 1);
+            if (data_.meta(index) == kEmpty || (Slots::kStoresPsl && get_dist(index) < dist)) {
+                count_lookup_probe(dist + 1);
+                return buffer_size_;
+            }
+            if (slot_equals(index, hash, key)) {
+                count_lookup_probe(dist + 1);
+                return index;
+            }
+            if (!Slots::kStoresPsl && get_dist(index) < dist) {
+                count_lookup_probe(dist + 1);
+                return buffer_size_;
+            }
+        }
+        count_lookup_probe(std::min(max_psl_ + 1, buffer_size_));
+        return buffer_size_;
+    }
+
+    // first slot where an absent element with the given mixed hash belongs:
+    // an empty slot or one holding a richer element
+    ProbeResult insert_point(size_t hash) const {
+        size_t index = hash & (buffer_size_ - 1);
+        size_t dist = 0;
+        while (data_.meta(index) != kEmpty && get_dist(index) >= dist) {
+            index = (index + 1) & (buffer_size_ - 1);
+            dist++;
+        }
+        return {index, dist, hash, false};
+    }
+
+    // the element of a slot of source, constructing from it moves it out with move_construct
+    struct MovedSlot {
+        Slots* source;
+        size_t index;
+    };
+
+    template <class... Args> void construct_slot(size_t index, Args&&... args) {
+        data_.construct(index, std::forward<Args>(args)...);
+    }
+
+    void construct_slot(size_t index, MovedSlot from) {
+        data_.move_construct(index, *from.source, from.index);
+    }
+
+    // constructs an absent element at its insertion point: the rest of the run is shifted
+    // one slot forward, which keeps the Robin Hood order, and the freed slot is built in place
+    template <class... Args> size_t emplace_at(const ProbeResult& probe, Args&&... args) {
+        size_t index = place_at(probe, max_psl_, std::forward<Args>(args)...);
+        cnt_all_++;
+        return index;
+    }
+
+    // emplace_at without counting the element, it raises max_psl to the PSLs it creates;
+    // parallel builders touch only their own slots and bounds
+    template <class... Args> size_t place_at(const ProbeResult& probe, size_t& max_psl, Args&&... args) {
+        size_t mask = buffer_size_ - 1;
+        size_t index = probe.index;
+        if (data_.meta(index) == kEmpty) {
+            construct_slot(index, std::forward<Args>(args)...);
+        } else {
+            size_t last = index;
+            while (data_.meta(last) != kEmpty) {
+                last = (last + 1) & mask;
+            }
+            for (size_t to = last; to != index; to = (to - 1) & mask) {
+                size_t from = (to - 1) & mask;
+                size_t dist = get_dist(from) + 1;
+                max_psl = std::max(max_psl, dist);
+                uint8_t meta = encode_dist(dist);
+                if (data_.meta(to) == kEmpty) {
+                    data_.move_construct(to, data_, from);
+                } else {
+                    data_.move_assign(to, from);
+                }
+                data_.set_hash(to, data_.hash(from));
+                data_.set_meta(to, meta);
+            }
+            data_.destroy(index);
+            try {
+                construct_slot(index, std::forward<Args>(args)...);
+            } catch (...) {
+                // shift the run back
+                for (size_t to = index; to != last; to = (to + 1) & mask) {
+                    size_t from = (to + 1) & mask;
+                    uint8_t meta = encode_dist(get_dist(from) - 1);
+                    if (to == index) {
+                        data_.move_construct(to, data_, from);
+                    } else {
+                        data_.move_assign(to, from);
+                    }
+                    data_.set_hash(to, data_.hash(from));
+                    data_.set_meta(to, meta);
+                }
+                data_.destroy(last);
+                data_.set_meta(last, kEmpty);
+                throw;
+            }
+        }
+        data_.set_hash(index, probe.hash);
+        data_.set_meta(index, encode_dist(probe.dist));
+        max_psl = std::max(max_psl, probe.dist);
+        return index;
+    }
+
+    // smallest table able to hold count elements
+    size_t min_buckets(size_t count) const {
+        size_t buckets = default_size_;
+        while (count > buckets * load_factor_) {
+            buckets *= 2;
+        }
+        return buckets;
+    }
+
+    // grows the table in advance, so the next insert fits into max load factor;
+    // returns whether the table was rebuilt
+    bool resize() {
+        if (cnt_all_ + 1 > buffer_size_ * load_factor_) {
+            rehash_to(std::max(buffer_size_ * 2, default_size_));
+            return true;
+        }
+        return false;
+    }
+
+    // moves every element into a new table, keys are unique so no lookups are needed
+    void rehash_to(size_t new_size) {
+        counters_.rehashes++;
+        hash_map_detail::ScopedTimer timer(counters_.rehash_seconds);
+        Slots data_2(new_size, data_.get_allocator());
+        data_.swap(data_2);
+        buffer_size_ = new_size;
+        size_t count = cnt_all_;
+        cnt_all_ = 0;
+        max_psl_ = 0;
+        // parallel placement moves the pairs themselves
+        size_t threads = Slots::kStableElements ? 1 : threads_for(count);
+        if (threads > 1) {
+            std::vector<size_t> alive;
+            alive.reserve(count);
+            for (size_t i = 0; i < data_2.size(); i++) {
+                if (data_2.meta(i) != kEmpty) {
+                    alive.push_back(i);
+                }
+            }
+            parallel_build(alive.size(), threads, true,
+                           [&](size_t i) -> KvType&& { return std::move(data_2.kv(alive[i])); },
+                           [&](size_t i) {
+                               return StoreHash ? data_2.hash(alive[i]) : full_hash(Policy::key(data_2.kv(alive[i])));
+                           });
+            return;
+        }
+        for (size_t i = 0; i < data_2.size(); i++) {
+            if (data_2.meta(i) != kEmpty) {
+                size_t hash = StoreHash ? data_2.hash(i) : full_hash(Policy::key(data_2.kv(i)));
+                emplace_at(insert_point(hash), MovedSlot{&data_2, i});
+            }
+        }
+    }
+
+    // inserts n elements into the empty map, element(i) gives the i-th of them;
+    // `unique` - the elements come from a map, so their keys are distinct
+    template <class Element> void build(size_t n, bool unique, Element element) {
+        // stable nodes are allocated by the placing threads, and the allocator may not be thread-safe
+        size_t threads = Slots::kStableElements ? 1 : threads_for(n);
+        if (threads > 1 && empty()) {
+            parallel_build(n, threads, unique, element, [&](size_t i) { return full_hash(Policy::key(element(i))); });
+            return;
+        }
+        for (size_t i = 0; i < n; i++) {
+            find_or_construct(Policy::key(element(i)), element(i));
+        }
+    }
+
+    // threads worth using for placing count elements, 1 means serial
+    size_t threads_for(size_t count) const {
+        if (count < kParallelBuildThreshold) {
+            return 1;
+        }
+        size_t threads = build_threads_ ? build_threads_ : std::thread::hardware_concurrency();
+        // every thread gets a range of at least kMinBuildRange slots
+        return std::max<size_t>(1, std::min(threads, buffer_size_ / kMinBuildRange));
+    }
+
+    // runs f(0), ..., f(threads - 1) in parallel and rethrows the first exception
+    template <class F> static void run_parallel(size_t threads, F f) {
+        std::vector<std::exception_ptr> errors(threads);
+        std::vector<std::thread> workers;
+        auto guarded = [&](size_t t) {
+            try {
+                f(t);
+            } catch (...) {
+                errors[t] = std::current_exception();
+            }
+        };
+        for (size_t t = 1; t < threads; t++) {
+            workers.emplace_back(guarded, t);
+        }
+        guarded(0);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        for (std::exception_ptr& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+    }
+
+    using Overflow = std::vector<std::pair<KvType, size_t>>;
+
+    // fills the empty table with n elements: thread t places the elements whose home slot lies
+    // in its own contiguous range of slots, elements pushed past the end of a range (including
+    // the wrap-around of the last one) are inserted serially afterwards.
+    // element(i) gives the element to copy or move from, element_hash(i) its mixed hash;
+    // with `unique` keys aren't looked up, otherwise the first of equal keys wins.
+    // Hash and Equal are called concurrently
+    template <class Element, class ElementHash>
+    void parallel_build(size_t n, size_t threads, bool unique, Element element, ElementHash element_hash) {
+        std::vector<size_t> hashes(n);
+        run_parallel(threads, [&](size_t t) {
+            for (size_t i = n * t / threads; i < n * (t + 1) / threads; i++) {
+                hashes[i] = element_hash(i);
+            }
+        });
+        // counting sort by range keeps the input order within a range
+        size_t range = (buffer_size_ + threads - 1) / threads;
+        std::vector<size_t> starts(threads + 1);
+        for (size_t i = 0; i < n; i++) {
+            starts[(hashes[i] & (buffer_size_ - 1)) / range + 1]++;
+        }
+        for (size_t t = 0; t < threads; t++) {
+            starts[t + 1] += starts[t];
+        }
+        std::vector<size_t> order(n);
+        std::vector<size_t> next(starts.begin(), starts.end() - 1);
+        for (size_t i = 0; i < n; i++) {
+            order[next[(hashes[i] & (buffer_size_ - 1)) / range]++] = i;
+        }
+
+        std::vector<Overflow> overflow(threads);
+        std::vector<size_t> placed(threads);
+        std::vector<size_t> max_psl(threads);
+        try {
+            run_parallel(threads, [&](size_t t) {
+                size_t end = std::min(buffer_size_, range * (t + 1));
+                for (size_t k = starts[t]; k < starts[t + 1]; k++) {
+                    size_t i = order[k];
+                    place_in_range(element(i), hashes[i], end, unique, overflow[t], placed[t],
+                                   max_psl[t]);
+                }
+            });
+        } catch (...) {
+            cnt_all_ = 0;
+            for (size_t i = 0; i < buffer_size_; i++) {
+                if (data_.meta(i) != kEmpty) {
+                    cnt_all_++;
+                    max_psl_ = std::max(max_psl_, get_dist(i));
+                }
+            }
+            throw;
+        }
+        for (size_t t = 0; t < threads; t++) {
+            cnt_all_ += placed[t];
+            max_psl_ = std::max(max_psl_, max_psl[t]);
+        }
+        for (Overflow& rest : overflow) {
+            for (auto& keyvalue : rest) {
+                emplace_at(insert_point(keyvalue.second), std::move(keyvalue.first));
+            }
+        }
+    }
+
+    // Robin Hood insertion that stays between the home slot of the key and the end of its
+    // range; an element that doesn't fit before end goes to overflow
+    template <class Arg>
+    void place_in_range(Arg&& keyvalue, size_t hash, size_t end, bool unique,
+                        Overflow& overflow, size_t& placed, size_t& max_psl) {
+        size_t index = hash & (buffer_size_ - 1);
+        size_t dist = 0;
+        while (index < end && data_.meta(index) != kEmpty && get_dist(index) >= dist) {
+            if (!unique && slot_equals(index, hash, Policy::key(keyvalue))) {
+                return;
+            }
+            index++;
+            dist++;
+        }
+        if (index == end) {
+            // an earlier equal key may have been pushed out of the range as well
+            if (!unique) {
+                for (const auto& pushed : overflow) {
+                    if (pushed.second == hash && key_equal_(Policy::key(pushed.first), Policy::key(keyvalue))) {
+                        return;
+                    }
+                }
+            }
+            overflow.emplace_back(KvType(std::forward<Arg>(keyvalue)), hash);
+            return;
+        }
+        size_t last = index;
+        while (last < end && data_.meta(last) != kEmpty) {
+            last++;
+        }
+        if (last == end) {
+            // the run reaches the end of the range: its last element makes room
+            last = end - 1;
+            overflow.emplace_back(std::move(data_.kv(last)), slot_hash(last));
+            data_.destroy(last);
+            data_.set_meta(last, kEmpty);
+            placed--;
+        }
+        place_at({index, dist, hash, false}, max_psl, std::forward<Arg>(keyvalue));
+        placed++;
+    }
+};
+
+// Robin Hood hash map of KeyType to ValueType, see RobinHoodTable
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType>, class Equal = std::equal_to<KeyType>,
+         class Storage = NodeStorage, bool StoreHash = default_store_hash<KeyType>::value,
+         class Allocator = std::allocator<std::pair<const KeyType, ValueType>>>
+class HashMap : public RobinHoodTable<hash_map_detail::MapElement<KeyType, ValueType>, Hash, Equal, Storage,
+                                      StoreHash, Allocator> {
+    using Base = RobinHoodTable<hash_map_detail::MapElement<KeyType, ValueType>, Hash, Equal, Storage,
+                                StoreHash, Allocator>;
+
+public:
+    using typename Base::KvType;
+    using typename Base::iterator;
+    using typename Base::const_iterator;
+
+    using Base::Base;
+
+    iterator insert(const KvType& keyvalue) {
+        return try_emplace(keyvalue.first, keyvalue.second).first;
+    }
+
+    iterator insert(KvType&& keyvalue) {
+        return try_emplace(std::move(keyvalue.first), std::move(keyvalue.second)).first;
+    }
+
+    // the value is constructed from args only if the key is absent
+    template <class... Args> std::pair<iterator, bool> try_emplace(const KeyType& key, Args&&... args) {
+        return try_emplace_impl(key, std::forward<Args>(args)...);
+    }
+
+    template <class... Args> std::pair<iterator, bool> try_emplace(KeyType&& key, Args&&... args) {
+        return try_emplace_impl(std::move(key), std::forward<Args>(args)...);
+    }
+
+    template <class M> std::pair<iterator, bool> insert_or_assign(const KeyType& key, M&& value) {
+        return insert_or_assign_impl(key, std::forward<M>(value));
+    }
+
+    template <class M> std::pair<iterator, bool> insert_or_assign(KeyType&& key, M&& value) {
+        return insert_or_assign_impl(std::move(key), std::forward<M>(value));
+    }
+
+    ValueType& operator [](const KeyType& key){
+        return try_emplace(key).first -> second;
+    }
+
+    ValueType& operator [](KeyType&& key){
+        return try_emplace(std::move(key)).first -> second;
+    }
+
+    ValueType& at(const KeyType& key) {
+        return this->slot(this->at_index(key)).second;
+    }
+
+    const ValueType& at(const KeyType& key) const{
+        return this->slot(this->at_index(key)).second;
+    }
+
+    template <class K, class H = Hash, class E = Equal, hash_map_detail::enable_transparent<H, E> = 0>
+    ValueType& at(const K& key) {
+        return this->slot(this->at_index(key)).second;
+    }
+
+    template <class K, class H = Hash, class E = Equal, hash_map_detail::enable_transparent<H, E> = 0>
+    const ValueType& at(const K& key) const {
+        return this->slot(this->at_index(key)).second;
+    }
+
+    // merge that combines the values of the keys present in both maps:
+    // combine(value, other_value) updates the value here from an rvalue of the other one
+    template <class Combine> size_t merge_with(HashMap&& other, Combine combine) {
+        return this->merge_impl(other, [&](KvType& keyvalue, KvType& other_keyvalue) {
+            combine(keyvalue.second, std::move(other_keyvalue.second));
+        });
+    }
+
+private:
+    template <class KeyArg, class... Args>
+    std::pair<iterator, bool> try_emplace_impl(KeyArg&& key, Args&&... args) {
+        return this->find_or_construct(key, std::piecewise_construct, std::forward_as_tuple(std::forward<KeyArg>(key)),
+                                       std::forward_as_tuple(std::forward<Args>(args)...));
+    }
+
+    template <class KeyArg, class M>
+    std::pair<iterator, bool> insert_or_assign_impl(KeyArg&& key, M&& value) {
+        auto result = try_emplace_impl(std::forward<KeyArg>(key), std::forward<M>(value));
+        if (!result.second) {
+            result.first->second = std::forward<M>(value);
+        }
+        return result;
+    }
+};
+
+/*
+ * Robin Hood hash set: the slots hold bare keys, without a value and its padding,
+ * and iterators give const keys. for_each calls f(key).
+ */
+template<class KeyType, class Hash = std::hash<KeyType>, class Equal = std::equal_to<KeyType>,
+         class Storage = NodeStorage, bool StoreHash = default_store_hash<KeyType>::value,
+         class Allocator = std::allocator<KeyType>>
+class HashSet : public RobinHoodTable<hash_map_detail::SetElement<KeyType>, Hash, Equal, Storage,
+                                      StoreHash, Allocator> {
+    using Base = RobinHoodTable<hash_map_detail::SetElement<KeyType>, Hash, Equal, Storage, StoreHash, Allocator>;
+
+public:
+    using typename Base::iterator;
+    using typename Base::const_iterator;
+
+    using Base::Base;
+
+    // the bool tells whether the key was inserted, i.e. wasn't present yet
+    std::pair<iterator, bool> insert(const KeyType& key) {
+        return this->find_or_construct(key, key);
+    }
+
+    std::pair<iterator, bool> insert(KeyType&& key) {
+        return this->find_or_construct(key, std::move(key));
+    }
+};
+
+// map of integer keys whose slots are just the pairs, EmptyKey is reserved, see SentinelStorage
+template <class KeyType, class ValueType, KeyType EmptyKey = std::numeric_limits<KeyType>::max(),
+          class Hash = std::hash<KeyType>, class Equal = std::equal_to<KeyType>>
+using IntHashMap = HashMap<KeyType, ValueType, Hash, Equal, SentinelStorage<EmptyKey>, false>;
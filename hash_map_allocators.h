@@ -0,0 +1,138 @@
+/*
+ * Allocators for HashMap slot arrays.
+ *
+ * AlignedAllocator starts every array at an Alignment boundary (a cache line by default),
+ * so slots and metadata groups don't straddle more cache lines than they have to.
+ *
+ * HugePageAllocator maps arrays of at least one huge page directly, aligned to a huge page and
+ * advised for transparent huge pages: random probes into a multi-GB table then cost far fewer
+ * TLB misses. Smaller arrays, and systems without mmap, fall back to AlignedAllocator.
+ *
+ * hash_map_pmr::HashMap takes a std::pmr::memory_resource, e.g. a per-request
+ * std::pmr::monotonic_buffer_resource that is freed wholesale.
+ */
+
+#pragma once
+
+#include "hash_map.h"
+
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+
+template <class T, size_t Alignment = 64> class AlignedAllocator {
+    static_assert((Alignment & (Alignment - 1)) == 0, "alignment must be a power of two");
+
+public:
+    using value_type = T;
+    using is_always_equal = std::true_type;
+    static constexpr size_t kAlignment = std::max(Alignment, alignof(T));
+
+    template <class U> struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() noexcept = default;
+
+    template <class U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+    T* allocate(size_t n) {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(kAlignment)));
+    }
+
+    void deallocate(T* p, size_t) noexcept {
+        ::operator delete(p, std::align_val_t(kAlignment));
+    }
+
+    template <class U> bool operator ==(const AlignedAllocator<U, Alignment>&) const noexcept {
+        return true;
+    }
+
+    template <class U> bool operator !=(const AlignedAllocator<U, Alignment>&) const noexcept {
+        return false;
+    }
+};
+
+template <class T> class HugePageAllocator {
+public:
+    using value_type = T;
+    using is_always_equal = std::true_type;
+    static constexpr size_t kHugePage = size_t(2) << 20;
+
+    HugePageAllocator() noexcept = default;
+
+    template <class U> HugePageAllocator(const HugePageAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        if (n > (std::numeric_limits<size_t>::max() - kHugePage) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+#if defined(__linux__)
+        size_t bytes = n * sizeof(T);
+        if (bytes >= kHugePage) {
+            size_t len = round_up(bytes);
+            // map one huge page more and trim both ends, so the array starts at a huge page boundary
+            void* raw = mmap(nullptr, len + kHugePage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw == MAP_FAILED) {
+                throw std::bad_alloc();
+            }
+            uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+            uintptr_t aligned = (start + kHugePage - 1) & ~(kHugePage - 1);
+            if (aligned != start) {
+                munmap(raw, aligned - start);
+            }
+            munmap(reinterpret_cast<void*>(aligned + len), kHugePage - (aligned - start));
+#if defined(MADV_HUGEPAGE)
+            // only a hint: without THP the mapping still works with normal pages
+            madvise(reinterpret_cast<void*>(aligned), len, MADV_HUGEPAGE);
+#endif
+            return reinterpret_cast<T*>(aligned);
+        }
+#endif
+        return AlignedAllocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+#if defined(__linux__)
+        if (n * sizeof(T) >= kHugePage) {
+            munmap(p, round_up(n * sizeof(T)));
+            return;
+        }
+#endif
+        AlignedAllocator<T>().deallocate(p, n);
+    }
+
+    template <class U> bool operator ==(const HugePageAllocator<U>&) const noexcept {
+        return true;
+    }
+
+    template <class U> bool operator !=(const HugePageAllocator<U>&) const noexcept {
+        return false;
+    }
+
+private:
+    static size_t round_up(size_t bytes) {
+        return (bytes + kHugePage - 1) & ~(kHugePage - 1);
+    }
+};
+
+namespace hash_map_pmr {
+
+template <class KeyType, class ValueType, class Hash = std::hash<KeyType>, class Equal = std::equal_to<KeyType>,
+          class Storage = NodeStorage, bool StoreHash = default_store_hash<KeyType>::value>
+using HashMap = ::HashMap<KeyType, ValueType, Hash, Equal, Storage, StoreHash,
+                          std::pmr::polymorphic_allocator<std::pair<const KeyType, ValueType>>>;
+
+template <class KeyType, class Hash = std::hash<KeyType>, class Equal = std::equal_to<KeyType>,
+          class Storage = NodeStorage, bool StoreHash = default_store_hash<KeyType>::value>
+using HashSet = ::HashSet<KeyType, Hash, Equal, Storage, StoreHash, std::pmr::polymorphic_allocator<KeyType>>;
+
+} // namespace hash_map_pmr
@@ -0,0 +1,215 @@
+/*
+ * Seeded hash functions for the Hash parameter of HashMap and HashSet.
+ *
+ * FastHash<K> hashes integers, enums and pointers with a multiply-xorshift mixer, and strings
+ * (std::string, std::string_view) with a wyhash-style function of their bytes; string hashers are
+ * transparent, so they also take string views and C strings. Other keys get std::hash<K>
+ * post-mixed with the seed, as any hasher does in SeededHash<Hash>.
+ *
+ * The default seed is 0, so tables are reproducible; snapshots save any seed. For untrusted keys
+ * use randomized() hashers: every one of them draws its own seed, so keys colliding in the low
+ * bits of a table can't be prepared in advance. Post-mixing can't separate keys whose inner hashes
+ * are equal, only FastHash of integers and strings resists hash flooding completely.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+
+namespace hash_map_detail {
+
+// 64x64 -> 128 bit multiply, the low half goes to a and the high half to b
+inline void mul128(uint64_t& a, uint64_t& b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = static_cast<__uint128_t>(a) * b;
+    a = static_cast<uint64_t>(product);
+    b = static_cast<uint64_t>(product >> 64);
+#else
+    uint64_t a_hi = a >> 32, a_lo = static_cast<uint32_t>(a);
+    uint64_t b_hi = b >> 32, b_lo = static_cast<uint32_t>(b);
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + static_cast<uint32_t>(hi_lo) + lo_hi;
+    a = (cross << 32) | static_cast<uint32_t>(lo_lo);
+    b = hi_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+}
+
+// multiplies and folds the halves of the product together
+inline uint64_t mum(uint64_t a, uint64_t b) {
+    mul128(a, b);
+    return a ^ b;
+}
+
+inline uint64_t read64(const unsigned char* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t read32(const unsigned char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// 1 to 3 bytes, each of them lands in the result
+inline uint64_t read_small(const unsigned char* p, size_t len) {
+    return (uint64_t(p[0]) << 16) | (uint64_t(p[len >> 1]) << 8) | p[len - 1];
+}
+
+constexpr uint64_t kHashSecret[4] = {0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+                                     0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull};
+
+// wyhash-style hash of len bytes: 16 bytes per multiply, three independent lanes for long inputs
+inline uint64_t hash_bytes(const void* data, size_t len, uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    seed ^= mum(seed ^ kHashSecret[0], kHashSecret[1]);
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (len <= 16) {
+        if (len >= 4) {
+            size_t offset = (len >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + offset);
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - offset);
+        } else if (len > 0) {
+            a = read_small(p, len);
+        }
+    } else {
+        size_t rest = len;
+        if (rest > 48) {
+            uint64_t lane_1 = seed;
+            uint64_t lane_2 = seed;
+            do {
+                seed = mum(read64(p) ^ kHashSecret[1], read64(p + 8) ^ seed);
+                lane_1 = mum(read64(p + 16) ^ kHashSecret[2], read64(p + 24) ^ lane_1);
+                lane_2 = mum(read64(p + 32) ^ kHashSecret[3], read64(p + 40) ^ lane_2);
+                p += 48;
+                rest -= 48;
+            } while (rest > 48);
+            seed ^= lane_1 ^ lane_2;
+        }
+        while (rest > 16) {
+            seed = mum(read64(p) ^ kHashSecret[1], read64(p + 8) ^ seed);
+            p += 16;
+            rest -= 16;
+        }
+        // the last 16 bytes, overlapping the consumed ones for short tails
+        a = read64(p + rest - 16);
+        b = read64(p + rest - 8);
+    }
+    a ^= kHashSecret[1];
+    b ^= seed;
+    mul128(a, b);
+    return mum(a ^ kHashSecret[0] ^ len, b ^ kHashSecret[1]);
+}
+
+// multiply-xorshift mixer, a bijection of x for every seed
+inline uint64_t hash_int(uint64_t x, uint64_t seed) {
+    x += seed + 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// a fresh seed per call: a per-process random base and a counter, mixed
+inline uint64_t random_seed() {
+    static const uint64_t base = [] {
+        uint64_t entropy = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+        try {
+            std::random_device device;
+            entropy ^= (uint64_t(device()) << 32) | device();
+        } catch (...) {
+            // no entropy source, the clock and the address below still differ between runs
+        }
+        return hash_int(entropy, reinterpret_cast<uintptr_t>(&entropy));
+    }();
+    static std::atomic<uint64_t> counter{0};
+    return hash_int(counter.fetch_add(1, std::memory_order_relaxed), base);
+}
+
+template <class KeyType> struct is_string_key
+    : std::integral_constant<bool, std::is_same<KeyType, std::string>::value ||
+                                   std::is_same<KeyType, std::string_view>::value> {};
+
+} // namespace hash_map_detail
+
+
+template <class KeyType, class = void> class FastHash {
+public:
+    explicit FastHash(uint64_t seed = 0) : seed_(seed) {}
+
+    static FastHash randomized() {
+        return FastHash(hash_map_detail::random_seed());
+    }
+
+    uint64_t seed() const {
+        return seed_;
+    }
+
+    size_t operator()(const KeyType& key) const {
+        if constexpr (std::is_integral<KeyType>::value || std::is_enum<KeyType>::value) {
+            return hash_map_detail::hash_int(static_cast<uint64_t>(key), seed_);
+        } else if constexpr (std::is_pointer<KeyType>::value) {
+            return hash_map_detail::hash_int(reinterpret_cast<uintptr_t>(key), seed_);
+        } else {
+            return hash_map_detail::hash_int(std::hash<KeyType>()(key), seed_);
+        }
+    }
+
+private:
+    uint64_t seed_;
+};
+
+// hashes the characters, any string view-like key can be looked up
+template <class KeyType>
+class FastHash<KeyType, std::enable_if_t<hash_map_detail::is_string_key<KeyType>::value>> {
+public:
+    using is_transparent = void;
+
+    explicit FastHash(uint64_t seed = 0) : seed_(seed) {}
+
+    static FastHash randomized() {
+        return FastHash(hash_map_detail::random_seed());
+    }
+
+    uint64_t seed() const {
+        return seed_;
+    }
+
+    size_t operator()(std::string_view key) const {
+        return hash_map_detail::hash_bytes(key.data(), key.size(), seed_);
+    }
+
+private:
+    uint64_t seed_;
+};
+
+// Hash with its result post-mixed by the seed
+template <class Hash> class SeededHash : private Hash {
+public:
+    explicit SeededHash(uint64_t seed = 0, Hash hasher = Hash()) : Hash(std::move(hasher)), seed_(seed) {}
+
+    static SeededHash randomized(Hash hasher = Hash()) {
+        return SeededHash(hash_map_detail::random_seed(), std::move(hasher));
+    }
+
+    uint64_t seed() const {
+        return seed_;
+    }
+
+    template <class K> size_t operator()(const K& key) const {
+        return hash_map_detail::hash_int(static_cast<const Hash&>(*this)(key), seed_);
+    }
+
+private:
+    uint64_t seed_;
+};
@@ -0,0 +1,415 @@
+/*
+ * Persistent snapshots of HashMap with trivially copyable keys and values.
+ *
+ * save_snapshot() writes the slot array as it is: a header, the metadata bytes (with a mirrored
+ * tail wide enough for any MetaGroup) and the pairs, empty slots written as zeros. The metadata
+ * always holds the PSLs, they're recomputed for storages without them (SentinelStorage).
+ * MappedHashMap maps such a file read-only and looks keys up right in the mapped pages, so
+ * opening costs no parsing or rehashing; load_snapshot() copies a snapshot into a mutable HashMap.
+ *
+ * The format is native: it's checked by version, type sizes and a hash fingerprint (which catches
+ * a different hasher or seed) but it isn't portable between architectures. POSIX only.
+ * The seed of a hasher with seed() (FastHash, SeededHash) is saved too, and the mapped and loaded
+ * maps rebuild their hasher from it, so maps with randomized() hashers reload as well.
+ */
+
+#pragma once
+
+#include "hash_map.h"
+
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace hash_map_detail {
+
+// widest MetaGroup, mapped metadata has its tail mirrored for it
+constexpr size_t kSnapshotGroupWidth = 32;
+static_assert(MetaGroup::kWidth <= kSnapshotGroupWidth, "snapshot metadata tail is too short");
+
+struct SnapshotHeader {
+    static constexpr char kMagic[8] = {'R', 'H', 'S', 'N', 'A', 'P', '\0', '\0'};
+    static constexpr uint32_t kVersion = 2;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t key_size;
+    uint64_t value_size;
+    uint64_t pair_size;
+    uint64_t buffer_size;
+    uint64_t count;
+    // offsets from the beginning of the file
+    uint64_t meta_offset;
+    uint64_t pairs_offset;
+    uint64_t file_size;
+    // mixed hashes of two fixed keys
+    uint64_t hash_check;
+    // seed() of the hasher, 0 for hashers without one
+    uint64_t hash_seed;
+    double max_load_factor;
+};
+
+template <class KeyType, class Hash> uint64_t snapshot_hash_check(const Hash& hasher) {
+    alignas(KeyType) unsigned char bytes[sizeof(KeyType)] = {};
+    uint64_t zero = mix_hash(hasher(*reinterpret_cast<const KeyType*>(bytes)));
+    std::memset(bytes, 0x5A, sizeof(bytes));
+    return zero ^ mix_hash(~hasher(*reinterpret_cast<const KeyType*>(bytes)));
+}
+
+// hashers constructible from their seed(), see hash_map_hashers.h
+template <class Hash, class = void> struct has_seed : std::false_type {};
+template <class Hash>
+struct has_seed<Hash, std::void_t<decltype(std::declval<const Hash&>().seed())>>
+    : std::is_constructible<Hash, uint64_t> {};
+
+template <class Hash> uint64_t hasher_seed(const Hash& hasher) {
+    if constexpr (has_seed<Hash>::value) {
+        return hasher.seed();
+    } else {
+        return 0;
+    }
+}
+
+// the saved hasher: seeded ones are rebuilt from the seed, others are kept
+template <class Hash> Hash restore_hasher(Hash hasher, uint64_t seed) {
+    if constexpr (has_seed<Hash>::value) {
+        return Hash(seed);
+    } else {
+        return hasher;
+    }
+}
+
+inline uint64_t align_up(uint64_t offset, uint64_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+// reads the slots of a HashMap, which befriends it
+struct SnapshotAccess {
+    // the PSL of an occupied slot is recomputed for storages that don't keep it
+    template <class Map> static uint8_t meta(const Map& map, size_t i) {
+        return map.is_alive(i) ? Map::encode_dist(map.get_dist(i)) : Map::kEmpty;
+    }
+
+    template <class Map> static const typename Map::KvType& kv(const Map& map, size_t i) {
+        return map.data_.kv(i);
+    }
+};
+
+} // namespace hash_map_detail
+
+
+// writes map to path, throws std::runtime_error if the file can't be written
+template <class KeyType, class ValueType, class Hash, class Equal, class Storage, bool StoreHash, class Allocator>
+void save_snapshot(const HashMap<KeyType, ValueType, Hash, Equal, Storage, StoreHash, Allocator>& map,
+                   const std::string& path) {
+    static_assert(std::is_trivially_copyable<KeyType>::value && std::is_trivially_copyable<ValueType>::value,
+                  "snapshots store keys and values as raw bytes");
+    using hash_map_detail::SnapshotAccess;
+    using hash_map_detail::SnapshotHeader;
+    using Map = HashMap<KeyType, ValueType, Hash, Equal, Storage, StoreHash, Allocator>;
+    using KvType = typename Map::KvType;
+
+    size_t buckets = map.bucket_count();
+    SnapshotHeader header{};
+    std::memcpy(header.magic, SnapshotHeader::kMagic, sizeof(header.magic));
+    header.version = SnapshotHeader::kVersion;
+    header.header_size = sizeof(SnapshotHeader);
+    header.key_size = sizeof(KeyType);
+    header.value_size = sizeof(ValueType);
+    header.pair_size = sizeof(KvType);
+    header.buffer_size = buckets;
+    header.count = map.size();
+    header.meta_offset = sizeof(SnapshotHeader);
+    header.pairs_offset = hash_map_detail::align_up(
+            header.meta_offset + buckets + hash_map_detail::kSnapshotGroupWidth - 1, 64);
+    header.file_size = header.pairs_offset + buckets * sizeof(KvType);
+    header.hash_check = hash_map_detail::snapshot_hash_check<KeyType>(map.hash_function());
+    header.hash_seed = hash_map_detail::hasher_seed(map.hash_function());
+    header.max_load_factor = map.max_load_factor();
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::vector<char> meta(header.pairs_offset - header.meta_offset, 0);
+    for (size_t i = 0; i < buckets; i++) {
+        meta[i] = SnapshotAccess::meta(map, i);
+    }
+    for (size_t i = buckets; buckets && i < buckets + hash_map_detail::kSnapshotGroupWidth - 1; i++) {
+        meta[i] = meta[i % buckets];
+    }
+    out.write(meta.data(), meta.size());
+    alignas(KvType) char empty[sizeof(KvType)] = {};
+    for (size_t i = 0; i < buckets; i++) {
+        const char* bytes = SnapshotAccess::meta(map, i) ? reinterpret_cast<const char*>(&SnapshotAccess::kv(map, i))
+                                                         : empty;
+        out.write(bytes, sizeof(KvType));
+    }
+    out.close();
+    if (!out) {
+        throw std::runtime_error("can't write snapshot " + path);
+    }
+}
+
+
+/*
+ * Read-only HashMap over a mapped snapshot. Hash and Equal must be the ones of the saved map;
+ * a hasher with seed() is rebuilt from the saved seed. Lookups probe metadata groups like
+ * SplitStorage does.
+ */
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType>, class Equal = std::equal_to<KeyType>>
+class MappedHashMap {
+    static_assert(std::is_trivially_copyable<KeyType>::value && std::is_trivially_copyable<ValueType>::value,
+                  "snapshots store keys and values as raw bytes");
+
+public:
+    using KvType = std::pair<KeyType, ValueType>;
+    static constexpr uint8_t kEmpty = 0;
+    static constexpr uint8_t kSaturated = 0xFF;
+
+    struct const_iterator {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<const KeyType, ValueType>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        explicit const_iterator() : map_(nullptr) {}
+
+        explicit const_iterator(const MappedHashMap *map, size_t idx) : map_(map), idx_(idx) {}
+
+        bool operator==(const const_iterator &other) const {
+            return other.map_ == map_ && other.idx_ == idx_;
+        }
+        bool operator!=(const const_iterator &other) const {
+            return !(other == *this);
+        }
+
+        const_iterator &operator++() {
+            ++idx_;
+            advance_past_empty();
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        reference operator*() const {
+            return *operator->();
+        }
+
+        pointer operator->() const {
+            return reinterpret_cast<pointer>(map_->pairs_ + idx_);
+        }
+
+    private:
+        void advance_past_empty() {
+            while (idx_ < map_->buffer_size_ && map_->meta_[idx_] == kEmpty) {
+                ++idx_;
+            }
+        }
+
+        const MappedHashMap *map_ = nullptr;
+        size_t idx_ = 0;
+        friend MappedHashMap;
+    };
+
+    using iterator = const_iterator;
+
+    // maps the snapshot at path, throws std::runtime_error if it's missing or doesn't match the types
+    explicit MappedHashMap(const std::string& path, Hash hasher = Hash(), Equal key_equal = Equal())
+        : hasher_(std::move(hasher)), key_equal_(std::move(key_equal)) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("can't open snapshot " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(hash_map_detail::SnapshotHeader)) {
+            ::close(fd);
+            throw std::runtime_error("broken snapshot " + path);
+        }
+        size_ = st.st_size;
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("can't map snapshot " + path);
+        }
+        data_ = static_cast<const char*>(data);
+        try {
+            validate(path);
+        } catch (...) {
+            munmap(const_cast<char*>(data_), size_);
+            throw;
+        }
+    }
+
+    MappedHashMap(const MappedHashMap&) = delete;
+    MappedHashMap& operator = (const MappedHashMap&) = delete;
+
+    MappedHashMap(MappedHashMap&& other) noexcept
+        : hasher_(std::move(other.hasher_)), key_equal_(std::move(other.key_equal_)), data_(other.data_),
+          size_(other.size_), meta_(other.meta_), pairs_(other.pairs_), buffer_size_(other.buffer_size_),
+          cnt_all_(other.cnt_all_), load_factor_(other.load_factor_) {
+        other.data_ = nullptr;
+        other.buffer_size_ = 0;
+        other.cnt_all_ = 0;
+    }
+
+    ~MappedHashMap() {
+        if (data_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    // simple functions
+    size_t size() const {
+        return cnt_all_;
+    }
+
+    bool empty() const {
+        return cnt_all_ == 0;
+    }
+
+    size_t bucket_count() const {
+        return buffer_size_;
+    }
+
+    double max_load_factor() const {
+        return load_factor_;
+    }
+
+    Hash hash_function() const {
+        return hasher_;
+    }
+
+    Equal key_eq() const {
+        return key_equal_;
+    }
+
+    const_iterator begin() const {
+        const_iterator it(this, 0);
+        it.advance_past_empty();
+        return it;
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, buffer_size_);
+    }
+
+    // lookups
+    const_iterator find(const KeyType& key) const {
+        return const_iterator(this, find_index(key));
+    }
+
+    size_t count(const KeyType& key) const {
+        return find_index(key) != buffer_size_;
+    }
+
+    bool contains(const KeyType& key) const {
+        return find_index(key) != buffer_size_;
+    }
+
+    const ValueType& at(const KeyType& key) const {
+        size_t index = find_index(key);
+        if (index == buffer_size_) {
+            throw std::out_of_range("very sad:(");
+        }
+        return pairs_[index].second;
+    }
+
+private:
+    Hash hasher_;
+    Equal key_equal_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+    const uint8_t* meta_ = nullptr;
+    const KvType* pairs_ = nullptr;
+    size_t buffer_size_ = 0;
+    size_t cnt_all_ = 0;
+    double load_factor_ = 0.5;
+
+    void validate(const std::string& path) {
+        hash_map_detail::SnapshotHeader header;
+        std::memcpy(&header, data_, sizeof(header));
+        if (std::memcmp(header.magic, hash_map_detail::SnapshotHeader::kMagic, sizeof(header.magic)) != 0 ||
+            header.version != hash_map_detail::SnapshotHeader::kVersion ||
+            header.header_size != sizeof(header) || header.file_size != size_) {
+            throw std::runtime_error("not a snapshot of this version " + path);
+        }
+        if (header.key_size != sizeof(KeyType) || header.value_size != sizeof(ValueType) ||
+            header.pair_size != sizeof(KvType)) {
+            throw std::runtime_error("snapshot of other types " + path);
+        }
+        hasher_ = hash_map_detail::restore_hasher(std::move(hasher_), header.hash_seed);
+        if (header.hash_check != hash_map_detail::snapshot_hash_check<KeyType>(hasher_)) {
+            throw std::runtime_error("snapshot of another hash function " + path);
+        }
+        // the slot arrays must lie inside the file where save_snapshot puts them
+        if ((header.buffer_size & (header.buffer_size - 1)) != 0 || header.meta_offset != sizeof(header) ||
+            header.pairs_offset % alignof(KvType) != 0 ||
+            header.buffer_size > (size_ - header.meta_offset) / (sizeof(KvType) + 1) ||
+            header.meta_offset + header.buffer_size + hash_map_detail::kSnapshotGroupWidth - 1 > header.pairs_offset ||
+            header.pairs_offset + header.buffer_size * sizeof(KvType) != header.file_size ||
+            header.count > header.buffer_size) {
+            throw std::runtime_error("broken snapshot " + path);
+        }
+        buffer_size_ = header.buffer_size;
+        cnt_all_ = header.count;
+        load_factor_ = header.max_load_factor;
+        meta_ = reinterpret_cast<const uint8_t*>(data_ + header.meta_offset);
+        pairs_ = reinterpret_cast<const KvType*>(data_ + header.pairs_offset);
+    }
+
+    static uint8_t encode_dist(size_t dist) {
+        return dist + 1 < kSaturated ? static_cast<uint8_t>(dist + 1) : kSaturated;
+    }
+
+    // group probe of HashMap over the mapped metadata
+    size_t find_index(const KeyType& key) const {
+        using hash_map_detail::MetaGroup;
+        size_t h1 = hash_map_detail::mix_hash(hasher_(key)) & (buffer_size_ - 1);
+        for (size_t dist = 0; dist < buffer_size_; dist += MetaGroup::kWidth) {
+            size_t index = (h1 + dist) & (buffer_size_ - 1);
+            hash_map_detail::GroupMask mask = MetaGroup::match_dist(meta_ + index, encode_dist(dist), kSaturated);
+            uint64_t match = mask.match;
+            if (mask.stop) {
+                match &= (mask.stop & (~mask.stop + 1)) - 1;
+            }
+            while (match) {
+                size_t slot = (index + hash_map_detail::lowest_slot(match)) & (buffer_size_ - 1);
+                if (key_equal_(pairs_[slot].first, key)) {
+                    return slot;
+                }
+                match &= match - 1;
+            }
+            if (mask.stop) {
+                break;
+            }
+        }
+        return buffer_size_;
+    }
+};
+
+
+// copies a snapshot into a mutable map
+template <class Map> Map load_snapshot(const std::string& path) {
+    using KeyType = typename Map::KvType::first_type;
+    using ValueType = typename Map::KvType::second_type;
+    MappedHashMap<KeyType, ValueType, decltype(std::declval<Map>().hash_function()),
+                  decltype(std::declval<Map>().key_eq())> mapped(path);
+    Map map(mapped.hash_function(), mapped.key_eq());
+    map.max_load_factor(mapped.max_load_factor());
+    map.reserve(mapped.size());
+    for (const auto& keyvalue : mapped) {
+        map.try_emplace(keyvalue.first, keyvalue.second);
+    }
+    return map;
+}
@@ -0,0 +1,313 @@
+/*
+ * Robin Hood hash table with incremental (amortized) rehash.
+ *
+ * HashMap grows stop-the-world: the insert crossing the load factor moves every element.
+ * IncrementalHashMap keeps two HashMap tables instead. When the active table is full,
+ * it becomes the old one and an empty table of twice the size takes its place; after that
+ * every modifying operation moves at most kMigrationSlots slots of the old table into the new one.
+ * Lookups and erases consult both tables until the old one is drained.
+ *
+ * Migration moves elements, so any non-const operation invalidates iterators.
+ */
+
+#pragma once
+
+#include "hash_map.h"
+
+
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType>, class Equal = std::equal_to<KeyType>,
+         class Storage = NodeStorage, bool StoreHash = default_store_hash<KeyType>::value,
+         class Allocator = std::allocator<std::pair<const KeyType, ValueType>>>
+class IncrementalHashMap {
+
+public:
+    using Table = HashMap<KeyType, ValueType, Hash, Equal, Storage, StoreHash, Allocator>;
+    using KvType = typename Table::KvType;
+
+    // slots of the old table handled by one operation
+    static constexpr size_t kMigrationSlots = 64;
+
+    // iterates over the old table, then over the active one
+    template <typename ContT, typename TableIt, typename IterVal> struct inc_iterator {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::remove_const_t<IterVal>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = IterVal*;
+        using reference = IterVal&;
+
+        explicit inc_iterator() : map_(nullptr) {}
+
+        explicit inc_iterator(ContT *map, bool in_old, TableIt it) : map_(map), in_old_(in_old), it_(it) {
+            skip_old_end();
+        }
+
+        template <typename OtherContT, typename OtherTableIt, typename OtherIterVal>
+        explicit inc_iterator(const inc_iterator<OtherContT, OtherTableIt, OtherIterVal> &other)
+            : map_(other.map_), in_old_(other.in_old_), it_(other.it_) {}
+
+        bool operator==(const inc_iterator &other) const {
+            return other.map_ == map_ && other.in_old_ == in_old_ && other.it_ == it_;
+        }
+        bool operator!=(const inc_iterator &other) const {
+            return !(other == *this);
+        }
+
+        inc_iterator &operator++() {
+            ++it_;
+            skip_old_end();
+            return *this;
+        }
+
+        inc_iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        IterVal& operator*() {
+            return *it_;
+        }
+
+        IterVal* operator->() {
+            return &*it_;
+        }
+
+    private:
+        void skip_old_end() {
+            if (in_old_ && it_ == map_->old_.end()) {
+                in_old_ = false;
+                it_ = map_->active_.begin();
+            }
+        }
+
+        ContT *map_ = nullptr;
+        bool in_old_ = false;
+        TableIt it_;
+        friend ContT;
+    };
+
+    using iterator = inc_iterator<IncrementalHashMap, typename Table::iterator,
+                                  std::pair<const KeyType, ValueType>>;
+    using const_iterator = inc_iterator<const IncrementalHashMap, typename Table::const_iterator,
+                                        const std::pair<const KeyType, ValueType>>;
+
+    // constructors
+    explicit IncrementalHashMap(Hash hasher = Hash(), Equal key_equal = Equal(), const Allocator& alloc = Allocator())
+        : active_(hasher, key_equal, alloc), old_(hasher, key_equal, alloc) {}
+
+    IncrementalHashMap(std::initializer_list<KvType> list): IncrementalHashMap() {
+        for (const KvType& keyvalue : list) {
+            insert(keyvalue);
+        }
+    }
+
+    // simple functions
+    size_t size() const {
+        return active_.size() + old_.size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t bucket_count() const {
+        return active_.bucket_count();
+    }
+
+    Hash hash_function() const {
+        return active_.hash_function();
+    }
+
+    Equal key_eq() const {
+        return active_.key_eq();
+    }
+
+    Allocator get_allocator() const {
+        return active_.get_allocator();
+    }
+
+    bool is_rehashing() const {
+        return rehashing_;
+    }
+
+    // drains the old table at once
+    void finish_rehash() {
+        while (rehashing_) {
+            migrate();
+        }
+    }
+
+    iterator begin() {
+        return iterator(this, true, old_.begin());
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, true, old_.begin());
+    }
+
+    iterator end() {
+        return iterator(this, false, active_.end());
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, false, active_.end());
+    }
+
+    // not such simple functions
+    iterator insert(const KvType& keyvalue) {
+        return try_emplace(keyvalue.first, keyvalue.second).first;
+    }
+
+    iterator insert(KvType&& keyvalue) {
+        return try_emplace(std::move(keyvalue.first), std::move(keyvalue.second)).first;
+    }
+
+    template <class... Args> std::pair<iterator, bool> try_emplace(const KeyType& key, Args&&... args) {
+        return try_emplace_impl(key, std::forward<Args>(args)...);
+    }
+
+    template <class... Args> std::pair<iterator, bool> try_emplace(KeyType&& key, Args&&... args) {
+        return try_emplace_impl(std::move(key), std::forward<Args>(args)...);
+    }
+
+    template <class M> std::pair<iterator, bool> insert_or_assign(const KeyType& key, M&& value) {
+        auto result = try_emplace(key, std::forward<M>(value));
+        if (!result.second) {
+            result.first->second = std::forward<M>(value);
+        }
+        return result;
+    }
+
+    template <class M> std::pair<iterator, bool> insert_or_assign(KeyType&& key, M&& value) {
+        auto result = try_emplace(std::move(key), std::forward<M>(value));
+        if (!result.second) {
+            result.first->second = std::forward<M>(value);
+        }
+        return result;
+    }
+
+    ValueType& operator [](const KeyType& key) {
+        return try_emplace(key).first -> second;
+    }
+
+    ValueType& operator [](KeyType&& key) {
+        return try_emplace(std::move(key)).first -> second;
+    }
+
+    void erase(const KeyType& key) {
+        migrate();
+        active_.erase(key);
+        if (rehashing_) {
+            old_.erase(key);
+        }
+    }
+
+    iterator find(const KeyType& key) {
+        migrate();
+        if (rehashing_) {
+            auto it = old_.find(key);
+            if (it != old_.end()) {
+                return iterator(this, true, it);
+            }
+        }
+        return iterator(this, false, active_.find(key));
+    }
+
+    const_iterator find(const KeyType& key) const {
+        if (rehashing_) {
+            auto it = old_.find(key);
+            if (it != old_.end()) {
+                return const_iterator(this, true, it);
+            }
+        }
+        return const_iterator(this, false, active_.find(key));
+    }
+
+    size_t count(const KeyType& key) const {
+        return contains(key);
+    }
+
+    bool contains(const KeyType& key) const {
+        return active_.contains(key) || (rehashing_ && old_.contains(key));
+    }
+
+    ValueType& at(const KeyType& key) {
+        iterator it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("very sad:(");
+        }
+        return it -> second;
+    }
+
+    const ValueType& at(const KeyType& key) const {
+        const_iterator it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("very sad:(");
+        }
+        return it -> second;
+    }
+
+    // keeps the capacity of the active table and drops the old one
+    void clear() {
+        active_.clear();
+        old_ = Table(active_.hash_function(), active_.key_eq(), active_.get_allocator());
+        rehashing_ = false;
+        cursor_ = 0;
+    }
+
+private:
+    Table active_;
+    Table old_;
+    bool rehashing_ = false;
+    // next slot of the old table to migrate
+    size_t cursor_ = 0;
+
+    template <class KeyArg, class... Args>
+    std::pair<iterator, bool> try_emplace_impl(KeyArg&& key, Args&&... args) {
+        if (size() + 1 > active_.bucket_count() * active_.max_load_factor()) {
+            // the active table is full: normally the old one is drained long before that
+            finish_rehash();
+            start_rehash();
+        }
+        migrate();
+        if (rehashing_) {
+            auto it = old_.find(key);
+            if (it != old_.end()) {
+                return {iterator(this, true, it), false};
+            }
+        }
+        auto result = active_.try_emplace(std::forward<KeyArg>(key), std::forward<Args>(args)...);
+        return {iterator(this, false, result.first), result.second};
+    }
+
+    void start_rehash() {
+        Table bigger(active_.hash_function(), active_.key_eq(), active_.get_allocator());
+        bigger.max_load_factor(active_.max_load_factor());
+        bigger.rehash(active_.bucket_count() * 2);
+        old_ = std::move(active_);
+        active_ = std::move(bigger);
+        rehashing_ = true;
+        cursor_ = 0;
+    }
+
+    // moves a bounded number of old table slots into the active table. Taking an element
+    // shifts the rest of its run back, so the cursor stays until its slot becomes empty;
+    // slots behind the cursor are all empty and the old table stays a valid Robin Hood table
+    void migrate() {
+        if (!rehashing_) {
+            return;
+        }
+        for (size_t step = 0; step < kMigrationSlots && !old_.empty(); step++) {
+            if (old_.is_alive(cursor_)) {
+                old_.move_slot_to(cursor_, active_);
+            } else {
+                cursor_++;
+            }
+        }
+        if (old_.empty()) {
+            old_ = Table(active_.hash_function(), active_.key_eq(), active_.get_allocator());
+            rehashing_ = false;
+            cursor_ = 0;
+        }
+    }
+};
@@ -1,8 +1,8 @@
-#include "hash_map_lists.h"
+#include "hash_map.h"
 #include <iostream>
 #include <cstdlib>
 #include <stdexcept>
-#include "unordered_map"
+#include <unordered_map>
 
 int main() {
     std::ios_base::sync_with_stdio(false);
@@ -0,0 +1,314 @@
+/*
+ * Sharded Robin Hood hash table for write-heavy multicore workloads.
+ *
+ * The high bits of a key's mixed hash pick one of Shards independent HashMap tables, each
+ * with its own mutex, so writers to different shards don't contend and a shard grows
+ * without stalling the rest. Every member call locks only the shard it touches.
+ *
+ * The HashMap-like API (find, insert, erase, operator[], at, iteration) hands out iterators and
+ * references into a shard; as with HashMap they are invalidated by a later modification of
+ * that shard, now possibly from another thread. Under concurrent writers use the callback
+ * API instead: visit() and upsert() run under the shard lock, for_each() locks one shard at a time.
+ * end() touches no shard, so `find(key) != end()` and contains() stay safe under concurrent writers.
+ */
+
+#pragma once
+
+#include "hash_map.h"
+
+#include <mutex>
+
+
+template<class KeyType, class ValueType, class Hash = std::hash<KeyType>, size_t Shards = 16,
+         class Equal = std::equal_to<KeyType>>
+class ShardedHashMap {
+    static_assert(Shards && (Shards & (Shards - 1)) == 0, "shard count must be a power of two");
+
+public:
+    using Table = HashMap<KeyType, ValueType, Hash, Equal>;
+    using KvType = typename Table::KvType;
+
+    // iterates over the shards in order
+    template <typename ContT, typename TableIt, typename IterVal> struct sh_iterator {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::remove_const_t<IterVal>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = IterVal*;
+        using reference = IterVal&;
+
+        explicit sh_iterator() : map_(nullptr) {}
+
+        explicit sh_iterator(ContT *map, size_t shard, TableIt it) : map_(map), shard_(shard), it_(it) {
+            skip_shard_ends();
+        }
+
+        template <typename OtherContT, typename OtherTableIt, typename OtherIterVal>
+        explicit sh_iterator(const sh_iterator<OtherContT, OtherTableIt, OtherIterVal> &other)
+            : map_(other.map_), shard_(other.shard_), it_(other.it_) {}
+
+        bool operator==(const sh_iterator &other) const {
+            return other.map_ == map_ && other.shard_ == shard_ && other.it_ == it_;
+        }
+        bool operator!=(const sh_iterator &other) const {
+            return !(other == *this);
+        }
+
+        sh_iterator &operator++() {
+            ++it_;
+            skip_shard_ends();
+            return *this;
+        }
+
+        sh_iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        IterVal& operator*() {
+            return *it_;
+        }
+
+        IterVal* operator->() {
+            return &*it_;
+        }
+
+    private:
+        // the end of every shard is the beginning of the next one, past the last shard is end()
+        void skip_shard_ends() {
+            while (shard_ < Shards && it_ == map_->shards_[shard_].table.end()) {
+                ++shard_;
+                it_ = shard_ < Shards ? map_->shards_[shard_].table.begin() : TableIt();
+            }
+        }
+
+        ContT *map_ = nullptr;
+        size_t shard_ = 0;
+        TableIt it_;
+        friend ContT;
+    };
+
+    using iterator = sh_iterator<ShardedHashMap, typename Table::iterator, std::pair<const KeyType, ValueType>>;
+    using const_iterator = sh_iterator<const ShardedHashMap, typename Table::const_iterator,
+                                       const std::pair<const KeyType, ValueType>>;
+
+    // constructors
+    explicit ShardedHashMap(Hash hasher = Hash(), Equal key_equal = Equal()) : hasher_(hasher) {
+        for (Shard& shard : shards_) {
+            shard.table = Table(hasher, key_equal);
+        }
+    }
+
+    ShardedHashMap(std::initializer_list<KvType> list): ShardedHashMap() {
+        for (const KvType& keyvalue : list) {
+            insert(keyvalue);
+        }
+    }
+
+    ShardedHashMap(const ShardedHashMap&) = delete;
+    ShardedHashMap& operator = (const ShardedHashMap&) = delete;
+
+    // simple functions
+    size_t size() const {
+        size_t result = 0;
+        for (const Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            result += shard.table.size();
+        }
+        return result;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    Hash hash_function() const {
+        return hasher_;
+    }
+
+    // reserves every shard for its share of `count`
+    void reserve(size_t count) {
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.table.reserve(count / Shards + 1);
+        }
+    }
+
+    iterator begin() {
+        return iterator(this, 0, shards_[0].table.begin());
+    }
+
+    const_iterator begin() const {
+        return const_iterator(this, 0, shards_[0].table.begin());
+    }
+
+    // a sentinel past the last shard
+    iterator end() {
+        return iterator(this, Shards, typename Table::iterator());
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, Shards, typename Table::const_iterator());
+    }
+
+    // not such simple functions
+    iterator insert(const KvType& keyvalue) {
+        return try_emplace(keyvalue.first, keyvalue.second).first;
+    }
+
+    iterator insert(KvType&& keyvalue) {
+        return try_emplace(std::move(keyvalue.first), std::move(keyvalue.second)).first;
+    }
+
+    template <class... Args> std::pair<iterator, bool> try_emplace(const KeyType& key, Args&&... args) {
+        return locked(key, [&](Table& table, size_t shard) {
+            auto result = table.try_emplace(key, std::forward<Args>(args)...);
+            return std::make_pair(iterator(this, shard, result.first), result.second);
+        });
+    }
+
+    template <class... Args> std::pair<iterator, bool> try_emplace(KeyType&& key, Args&&... args) {
+        return locked(key, [&](Table& table, size_t shard) {
+            auto result = table.try_emplace(std::move(key), std::forward<Args>(args)...);
+            return std::make_pair(iterator(this, shard, result.first), result.second);
+        });
+    }
+
+    template <class M> std::pair<iterator, bool> insert_or_assign(const KeyType& key, M&& value) {
+        return locked(key, [&](Table& table, size_t shard) {
+            auto result = table.insert_or_assign(key, std::forward<M>(value));
+            return std::make_pair(iterator(this, shard, result.first), result.second);
+        });
+    }
+
+    ValueType& operator [](const KeyType& key) {
+        return locked(key, [&](Table& table, size_t) -> ValueType& {
+            return table[key];
+        });
+    }
+
+    ValueType& operator [](KeyType&& key) {
+        return locked(key, [&](Table& table, size_t) -> ValueType& {
+            return table[std::move(key)];
+        });
+    }
+
+    void erase(const KeyType& key) {
+        locked(key, [&](Table& table, size_t) {
+            table.erase(key);
+        });
+    }
+
+    iterator find(const KeyType& key) {
+        return locked(key, [&](Table& table, size_t shard) {
+            auto it = table.find(key);
+            return it == table.end() ? end() : iterator(this, shard, it);
+        });
+    }
+
+    const_iterator find(const KeyType& key) const {
+        return locked(key, [&](const Table& table, size_t shard) {
+            auto it = table.find(key);
+            return it == table.end() ? end() : const_iterator(this, shard, it);
+        });
+    }
+
+    size_t count(const KeyType& key) const {
+        return contains(key);
+    }
+
+    bool contains(const KeyType& key) const {
+        return locked(key, [&](const Table& table, size_t) {
+            return table.contains(key);
+        });
+    }
+
+    ValueType& at(const KeyType& key) {
+        return locked(key, [&](Table& table, size_t) -> ValueType& {
+            return table.at(key);
+        });
+    }
+
+    const ValueType& at(const KeyType& key) const {
+        return locked(key, [&](const Table& table, size_t) -> const ValueType& {
+            return table.at(key);
+        });
+    }
+
+    void clear() {
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.table.clear();
+        }
+    }
+
+    // thread-safe access: f runs under the shard lock
+
+    // calls f(value) if the key is present, returns whether it was
+    template <class F> bool visit(const KeyType& key, F&& f) const {
+        return locked(key, [&](const Table& table, size_t) {
+            auto it = table.find(key);
+            if (it == table.end()) {
+                return false;
+            }
+            f(it->second);
+            return true;
+        });
+    }
+
+    // calls f(value&), the value is default constructed first if the key is absent
+    template <class F> void upsert(const KeyType& key, F&& f) {
+        locked(key, [&](Table& table, size_t) {
+            f(table[key]);
+        });
+    }
+
+    // calls f(key, value) for every element, locking one shard at a time
+    template <class F> void for_each(F&& f) const {
+        for (const Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (const auto& keyvalue : shard.table) {
+                f(keyvalue.first, keyvalue.second);
+            }
+        }
+    }
+
+private:
+    // shards don't share cache lines, so their locks don't ping-pong
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        Table table;
+    };
+
+    Hash hasher_;
+    Shard shards_[Shards];
+
+    static constexpr size_t shard_bits() {
+        size_t bits = 0;
+        while ((size_t(1) << bits) < Shards) {
+            bits++;
+        }
+        return bits;
+    }
+
+    // high hash bits pick the shard, the tables index by the low ones
+    size_t shard_of(const KeyType& key) const {
+        if constexpr (shard_bits() == 0) {
+            return 0;
+        } else {
+            return hash_map_detail::mix_hash(hasher_(key)) >> (sizeof(size_t) * 8 - shard_bits());
+        }
+    }
+
+    template <class F> decltype(auto) locked(const KeyType& key, F&& f) {
+        size_t shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shards_[shard].mutex);
+        return f(shards_[shard].table, shard);
+    }
+
+    template <class F> decltype(auto) locked(const KeyType& key, F&& f) const {
+        size_t shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shards_[shard].mutex);
+        return f(shards_[shard].table, shard);
+    }
+};
@@ -0,0 +1,344 @@
+/*
+ * Hash map for tiny key sets, with inline storage.
+ *
+ * SmallHashMap keeps up to N elements in an inline array and finds them by a linear scan
+ * with key_eq, without hashing. Inserting one more element spills all of them into a HashMap,
+ * and the map stays there until clear(). Construction and the inline state allocate nothing,
+ * and the spilled table is held by a pointer, so an inline map is little more than its N pairs.
+ *
+ * Iterators and references are invalidated by any insertion or erasure, like HashMap ones.
+ * Erasing an inline element moves the last inline element into its place.
+ */
+
+#pragma once
+
+#include "hash_map.h"
+
+#include <memory>
+
+
+template<class KeyType, class ValueType, size_t N = 8, class Hash = std::hash<KeyType>,
+         class Equal = std::equal_to<KeyType>>
+class SmallHashMap {
+    static_assert(N > 0, "inline capacity must be positive");
+
+public:
+    using Table = HashMap<KeyType, ValueType, Hash, Equal>;
+    using KvType = typename Table::KvType;
+
+    // walks the inline elements or the spilled table, whichever holds the elements
+    template <typename ContT, typename TableIt, typename IterVal> struct sm_iterator {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::remove_const_t<IterVal>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = IterVal*;
+        using reference = IterVal&;
+
+        explicit sm_iterator() : map_(nullptr) {}
+
+        explicit sm_iterator(ContT *map, size_t idx, TableIt it) : map_(map), idx_(idx), it_(it) {}
+
+        template <typename OtherContT, typename OtherTableIt, typename OtherIterVal>
+        explicit sm_iterator(const sm_iterator<OtherContT, OtherTableIt, OtherIterVal> &other)
+            : map_(other.map_), idx_(other.idx_), it_(other.it_) {}
+
+        bool operator==(const sm_iterator &other) const {
+            return other.map_ == map_ && other.idx_ == idx_ && other.it_ == it_;
+        }
+        bool operator!=(const sm_iterator &other) const {
+            return !(other == *this);
+        }
+
+        sm_iterator &operator++() {
+            if (map_->table_) {
+                ++it_;
+            } else {
+                ++idx_;
+            }
+            return *this;
+        }
+
+        sm_iterator operator++(int) {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        IterVal& operator*() {
+            return *operator->();
+        }
+
+        IterVal* operator->() {
+            if (map_->table_) {
+                return &*it_;
+            }
+            // casting std::pair<KeyType, ValueType> to std::pair<const KeyType, ValueType>
+            return reinterpret_cast<IterVal*>(&map_->inline_[idx_]);
+        }
+
+    private:
+        ContT *map_ = nullptr;
+        size_t idx_ = 0;
+        TableIt it_;
+        friend ContT;
+    };
+
+    using iterator = sm_iterator<SmallHashMap, typename Table::iterator, std::pair<const KeyType, ValueType>>;
+    using const_iterator = sm_iterator<const SmallHashMap, typename Table::const_iterator,
+                                       const std::pair<const KeyType, ValueType>>;
+
+    // constructors
+    explicit SmallHashMap(Hash hasher = Hash(), Equal key_equal = Equal())
+        : hasher_(std::move(hasher)), key_equal_(std::move(key_equal)) {}
+
+    SmallHashMap(std::initializer_list<KvType> list) : SmallHashMap() {
+        for (const KvType& keyvalue : list) {
+            insert(keyvalue);
+        }
+    }
+
+    template <class InputIt> SmallHashMap(InputIt first, InputIt last) : SmallHashMap() {
+        for (; first != last; ++first) {
+            insert(*first);
+        }
+    }
+
+    SmallHashMap(const SmallHashMap& other)
+        : table_(other.table_ ? std::make_unique<Table>(*other.table_) : nullptr), hasher_(other.hasher_),
+          key_equal_(other.key_equal_) {
+        for (; size_ < other.size_; size_++) {
+            new (&inline_[size_]) KvType(other.inline_[size_]);
+        }
+    }
+
+    SmallHashMap(SmallHashMap&& other) noexcept(std::is_nothrow_move_constructible<KvType>::value)
+        : table_(std::move(other.table_)), hasher_(other.hasher_), key_equal_(other.key_equal_) {
+        for (; size_ < other.size_; size_++) {
+            new (&inline_[size_]) KvType(std::move(other.inline_[size_]));
+        }
+        other.clear();
+    }
+
+    SmallHashMap& operator = (const SmallHashMap& other) {
+        if (this != &other) {
+            SmallHashMap copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    SmallHashMap& operator = (SmallHashMap&& other) {
+        if (this != &other) {
+            destroy_inline();
+            table_ = std::move(other.table_);
+            hasher_ = other.hasher_;
+            key_equal_ = other.key_equal_;
+            for (; size_ < other.size_; size_++) {
+                new (&inline_[size_]) KvType(std::move(other.inline_[size_]));
+            }
+            other.clear();
+        }
+        return *this;
+    }
+
+    ~SmallHashMap() {
+        destroy_inline();
+    }
+
+    // simple functions
+    size_t size() const {
+        return table_ ? table_->size() : size_;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // whether the elements are still inline, without a table
+    bool is_inline() const {
+        return !table_;
+    }
+
+    static constexpr size_t inline_capacity() {
+        return N;
+    }
+
+    Hash hash_function() const {
+        return hasher_;
+    }
+
+    Equal key_eq() const {
+        return key_equal_;
+    }
+
+    // inline iterators carry a default table iterator
+    iterator begin() {
+        return table_ ? iterator(this, 0, table_->begin()) : iterator(this, 0, TableIterator());
+    }
+
+    const_iterator begin() const {
+        return table_ ? const_iterator(this, 0, table_->begin()) : const_iterator(this, 0, ConstTableIterator());
+    }
+
+    iterator end() {
+        return table_ ? iterator(this, 0, table_->end()) : iterator(this, size_, TableIterator());
+    }
+
+    const_iterator end() const {
+        return table_ ? const_iterator(this, 0, table_->end()) : const_iterator(this, size_, ConstTableIterator());
+    }
+
+    // not such simple functions
+    iterator insert(const KvType& keyvalue) {
+        return try_emplace(keyvalue.first, keyvalue.second).first;
+    }
+
+    iterator insert(KvType&& keyvalue) {
+        return try_emplace(std::move(keyvalue.first), std::move(keyvalue.second)).first;
+    }
+
+    template <class... Args> std::pair<iterator, bool> try_emplace(const KeyType& key, Args&&... args) {
+        return try_emplace_impl(key, std::forward<Args>(args)...);
+    }
+
+    template <class... Args> std::pair<iterator, bool> try_emplace(KeyType&& key, Args&&... args) {
+        return try_emplace_impl(std::move(key), std::forward<Args>(args)...);
+    }
+
+    template <class M> std::pair<iterator, bool> insert_or_assign(const KeyType& key, M&& value) {
+        iterator it = find(key);
+        if (it != end()) {
+            it->second = std::forward<M>(value);
+            return {it, false};
+        }
+        return try_emplace(key, std::forward<M>(value));
+    }
+
+    ValueType& operator [](const KeyType& key) {
+        return try_emplace(key).first->second;
+    }
+
+    ValueType& operator [](KeyType&& key) {
+        return try_emplace(std::move(key)).first->second;
+    }
+
+    void erase(const KeyType& key) {
+        if (table_) {
+            table_->erase(key);
+            return;
+        }
+        size_t index = inline_index(key);
+        if (index == size_) {
+            return;
+        }
+        if (index + 1 != size_) {
+            inline_[index] = std::move(inline_[size_ - 1]);
+        }
+        inline_[--size_].~KvType();
+    }
+
+    iterator find(const KeyType& key) {
+        if (table_) {
+            return iterator(this, 0, table_->find(key));
+        }
+        return iterator(this, inline_index(key), TableIterator());
+    }
+
+    const_iterator find(const KeyType& key) const {
+        if (table_) {
+            return const_iterator(this, 0, table_->find(key));
+        }
+        return const_iterator(this, inline_index(key), ConstTableIterator());
+    }
+
+    size_t count(const KeyType& key) const {
+        return contains(key);
+    }
+
+    bool contains(const KeyType& key) const {
+        return table_ ? table_->contains(key) : inline_index(key) != size_;
+    }
+
+    ValueType& at(const KeyType& key) {
+        iterator it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("very sad:(");
+        }
+        return it->second;
+    }
+
+    const ValueType& at(const KeyType& key) const {
+        const_iterator it = find(key);
+        if (it == end()) {
+            throw std::out_of_range("very sad:(");
+        }
+        return it->second;
+    }
+
+    // back to the inline state, the spilled table is freed
+    void clear() {
+        destroy_inline();
+        table_.reset();
+    }
+
+private:
+    using TableIterator = typename Table::iterator;
+    using ConstTableIterator = typename Table::const_iterator;
+
+    // null while the map is inline
+    std::unique_ptr<Table> table_;
+    Hash hasher_;
+    Equal key_equal_;
+    size_t size_ = 0;
+    // first size_ slots are alive while the map is inline
+    union {
+        KvType inline_[N];
+    };
+
+    size_t inline_index(const KeyType& key) const {
+        for (size_t i = 0; i < size_; i++) {
+            if (key_equal_(inline_[i].first, key)) {
+                return i;
+            }
+        }
+        return size_;
+    }
+
+    void destroy_inline() noexcept {
+        for (; size_ > 0; size_--) {
+            inline_[size_ - 1].~KvType();
+        }
+    }
+
+    // moves the inline elements into the table, keeping room for as many more
+    void spill() {
+        auto table = std::make_unique<Table>(2 * N, hasher_, key_equal_);
+        for (size_t i = 0; i < size_; i++) {
+            table->insert(std::move(inline_[i]));
+        }
+        destroy_inline();
+        table_ = std::move(table);
+    }
+
+    template <class KeyArg, class... Args>
+    std::pair<iterator, bool> try_emplace_impl(KeyArg&& key, Args&&... args) {
+        if (!table_) {
+            size_t index = inline_index(key);
+            if (index != size_) {
+                return {iterator(this, index, TableIterator()), false};
+            }
+            if (size_ < N) {
+                new (&inline_[size_]) KvType(std::piecewise_construct, std::forward_as_tuple(std::forward<KeyArg>(key)),
+                                             std::forward_as_tuple(std::forward<Args>(args)...));
+                return {iterator(this, size_++, TableIterator()), true};
+            }
+            // key may refer into the inline array, build the pair before spilling
+            KvType keyvalue(std::piecewise_construct, std::forward_as_tuple(std::forward<KeyArg>(key)),
+                            std::forward_as_tuple(std::forward<Args>(args)...));
+            spill();
+            return {iterator(this, 0, table_->insert(std::move(keyvalue))), true};
+        }
+        auto result = table_->try_emplace(std::forward<KeyArg>(key), std::forward<Args>(args)...);
+        return {iterator(this, 0, result.first), result.second};
+    }
+};
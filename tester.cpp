@@ -1,9 +1,26 @@
-#include "hash_map_lists.h"
+#include "hash_map.h"
+#include "incremental_hash_map.h"
+#include "hash_map_allocators.h"
+#include "concurrent_hash_map.h"
+#include "sharded_hash_map.h"
+#include "hash_map_snapshot.h"
+#include "frozen_hash_map.h"
+#include "small_hash_map.h"
+#include "hash_map_hashers.h"
 #include <iostream>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
 #include <cstdlib>
 #include <functional>
 #include <stdexcept>
 #include <map>
+#include <set>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <array>
 
 void fail(const char *message) {
     std::cerr << "Fail:\n";
@@ -24,6 +41,7 @@ struct StrangeInt {
     StrangeInt(const StrangeInt& rs): x(rs.x) {
         ++counter;
     }
+    StrangeInt& operator =(const StrangeInt& rs) = default;
     bool operator ==(const StrangeInt& rs) const {
         return x == rs.x;
     }
@@ -257,6 +275,1493 @@ namespace internal_tests {
         std::cerr << "ok!\n";
     }
 
+/* compare with std::map on random operations, long runs included */
+    struct BadHash {
+        size_t operator()(int x) const {
+            return x / 300;
+        }
+    };
+
+    template <class Storage, bool StoreHash = false>
+    void check_random_ops() {
+        std::cerr << "check random operations... ";
+        HashMap<int, int, BadHash, std::equal_to<int>, Storage, StoreHash> map;
+        std::map<int, int> expected;
+        srand(17239);
+        for (int i = 0; i < 30000; ++i) {
+            int key = rand() % 3000;
+            int op = rand() % 3;
+            if (op == 0) {
+                map[key] = i;
+                expected[key] = i;
+            } else if (op == 1) {
+                map.erase(key);
+                expected.erase(key);
+            } else {
+                auto it = map.find(key);
+                auto exp_it = expected.find(key);
+                if ((it == map.end()) != (exp_it == expected.end()))
+                    fail("find disagrees with std::map");
+                if (it != map.end() && it->second != exp_it->second)
+                    fail("wrong value found");
+            }
+            if (map.size() != expected.size())
+                fail("wrong size");
+        }
+        size_t visited = 0;
+        for (auto cur : map) {
+            if (expected.at(cur.first) != cur.second)
+                fail("wrong value in iteration");
+            ++visited;
+        }
+        if (visited != expected.size())
+            fail("wrong iteration");
+        std::cerr << "ok!\n";
+    }
+
+/* check that split storage keeps the hash map interface */
+    void check_split_storage() {
+        std::cerr << "check split storage... ";
+        static_assert(std::is_same<
+                HashMap<int, int>,
+                HashMap<int, int, std::hash<int>, std::equal_to<int>, NodeStorage>
+        >::value, "node storage isn't the default");
+        HashMap<std::string, std::string, std::hash<std::string>, std::equal_to<std::string>, SplitStorage> map{
+                {"aba", "caba"},
+                {"simple", "case"}
+        };
+        map["test"] = "test";
+        map.erase("aba");
+        if (map.size() != 2 || map.at("simple") != "case" || map.find("aba") != map.end())
+            fail("wrong split storage");
+        auto it = map.find("test");
+        it->second = "changed";
+        const auto& const_map = map;
+        if (const_map.at("test") != "changed")
+            fail("can't modificate through iterator");
+        std::cerr << "ok!\n";
+    }
+
+/* check that insert/erase churn doesn't grow the table */
+    void check_churn() {
+        std::cerr << "check churn... ";
+        HashMap<int, int> map;
+        for (int i = 0; i < 100; ++i)
+            map[i] = i;
+        size_t buckets = map.bucket_count();
+        for (int i = 100; i < 100000; ++i) {
+            map[i] = i;
+            map.erase(i - 100);
+        }
+        if (map.size() != 100 || map.bucket_count() != buckets)
+            fail("table grows under churn");
+        for (int i = 99900; i < 100000; ++i)
+            if (map.find(i) == map.end() || map.find(i)->second != i)
+                fail("lost element after erase");
+        std::cerr << "ok!\n";
+    }
+
+/* check reserve, rehash and max load factor */
+    void check_reserve() {
+        std::cerr << "check reserve... ";
+        HashMap<int, int> map;
+        map.reserve(1000);
+        size_t buckets = map.bucket_count();
+        if (buckets * map.max_load_factor() < 1000)
+            fail("reserve doesn't make enough room");
+        for (int i = 0; i < 1000; ++i)
+            map[i] = i;
+        if (map.bucket_count() != buckets)
+            fail("table grows after reserve");
+        map.max_load_factor(0.98);
+        map.rehash(0);
+        if (map.bucket_count() >= buckets || map.load_factor() > 0.98)
+            fail("rehash doesn't shrink the table");
+        for (int i = 0; i < 1000; ++i)
+            if (map.at(i) != i)
+                fail("lost element after rehash");
+        try {
+            map.max_load_factor(1.5);
+            fail("max load factor accepts 1.5");
+        }
+        catch (const std::invalid_argument&) {}
+
+        std::vector<std::pair<int, int>> values;
+        for (int i = 0; i < 500; ++i)
+            values.emplace_back(i, -i);
+        HashMap<int, int> from_range(values.data(), values.data() + values.size());
+        if (from_range.bucket_count() != HashMap<int, int>(500).bucket_count())
+            fail("range constructor doesn't pre-size");
+        HashMap<int, int> hinted({{1, 1}}, 500);
+        if (hinted.bucket_count() != from_range.bucket_count() || hinted.at(1) != 1)
+            fail("capacity hint is ignored");
+        std::cerr << "ok!\n";
+    }
+
+/* check move semantics and in-place constructing inserts */
+    void check_move() {
+        std::cerr << "check move semantics... ";
+        static_assert(std::is_nothrow_move_constructible<HashMap<std::string, int>>::value,
+                "move constructor isn't noexcept");
+        static_assert(std::is_nothrow_move_assignable<HashMap<std::string, int>>::value,
+                "move assignment isn't noexcept");
+
+        HashMap<int, std::unique_ptr<int>> owners;
+        owners.insert(std::make_pair(1, std::make_unique<int>(10)));
+        owners.emplace(2, std::make_unique<int>(20));
+        owners.try_emplace(3, new int(30));
+        if (owners.try_emplace(3, std::make_unique<int>(31)).second)
+            fail("try_emplace replaces an existing element");
+        owners.insert_or_assign(2, std::make_unique<int>(21));
+        for (int i = 4; i < 100; ++i)
+            owners[i] = std::make_unique<int>(i);
+        if (*owners[1] != 10 || *owners[2] != 21 || *owners[3] != 30 || *owners[99] != 99)
+            fail("wrong values of move only type");
+
+        HashMap<int, std::unique_ptr<int>> moved(std::move(owners));
+        if (!owners.empty() || moved.size() != 99 || *moved[50] != 50)
+            fail("wrong move constructor");
+        owners[7] = std::make_unique<int>(7);
+        if (owners.size() != 1 || *owners[7] != 7)
+            fail("moved from map isn't usable");
+        owners = std::move(moved);
+        if (owners.size() != 99 || *owners.find(98)->second != 98)
+            fail("wrong move assignment");
+
+        StrangeInt::init();
+        {
+            HashMap<StrangeInt, int> map;
+            for (int i = 0; i < 100; ++i)
+                map.try_emplace(StrangeInt(i), i);
+            map.emplace(StrangeInt(5), 0);
+            map.insert_or_assign(StrangeInt(5), 55);
+            if (map.size() != 100 || map[StrangeInt(5)] != 55)
+                fail("wrong emplace");
+            for (int i = 0; i < 50; ++i)
+                map.erase(StrangeInt(i));
+            HashMap<StrangeInt, int> other;
+            other = std::move(map);
+            if (other.size() != 50)
+                fail("wrong size");
+        }
+        if (StrangeInt::counter)
+            fail("wrong destructor (or constructors)");
+        std::cerr << "ok!\n";
+    }
+
+/* check find-or-insert: counting and a throwing value constructor */
+    struct Picky {
+        int x;
+        Picky(int x): x(x) {
+            if (x < 0)
+                throw std::invalid_argument("negative");
+        }
+    };
+
+    void check_find_or_insert() {
+        std::cerr << "check find or insert... ";
+        HashMap<int, int> counter;
+        for (int i = 0; i < 10000; ++i)
+            counter[i % 777]++;
+        if (counter.size() != 777 || counter[0] != 13 || counter[776] != 12)
+            fail("wrong counting");
+
+        HashMap<int, Picky, BadHash> map;
+        for (int i = 0; i < 600; i += 2)
+            map.try_emplace(i, i);
+        for (int i = 1; i < 600; i += 2) {
+            try {
+                map.try_emplace(i, -i);
+                fail("constructor didn't throw");
+            }
+            catch (const std::invalid_argument&) {}
+        }
+        if (map.size() != 300)
+            fail("wrong size after exception");
+        for (int i = 0; i < 600; ++i)
+            if ((map.find(i) != map.end()) != (i % 2 == 0) || (i % 2 == 0 && map.at(i).x != i))
+                fail("lost element after exception");
+
+        // the value is copied from an element that the insertion shifts
+        HashMap<int, std::string> aliased;
+        aliased.reserve(1001);
+        for (int i = 0; i < 1000; ++i)
+            aliased[i] = std::string(40, 'x') + std::to_string(i);
+        int shifted = -1;
+        int key = 1000;
+        for (; shifted < 0; ++key) {
+            // erasing the trial key shifts the run back into place
+            std::map<int, const std::string*> addresses;
+            for (int i = 0; i < 1000; ++i)
+                addresses[i] = &aliased.at(i);
+            aliased[key];
+            for (int i = 0; i < 1000 && shifted < 0; ++i)
+                if (&aliased.at(i) != addresses[i])
+                    shifted = i;
+            aliased.erase(key);
+        }
+        --key;
+        if (!aliased.try_emplace(key, aliased.at(shifted)).second || aliased.at(key) != aliased.at(shifted) ||
+            aliased.at(shifted) != std::string(40, 'x') + std::to_string(shifted))
+            fail("inserted a moved-from value");
+        std::cerr << "ok!\n";
+    }
+
+/* check heterogeneous lookup with transparent hash and equality */
+    struct StrangeIntHash {
+        using is_transparent = void;
+        size_t operator()(int x) const {
+            return x;
+        }
+        size_t operator()(const StrangeInt& x) const {
+            return x.x;
+        }
+    };
+
+    struct StrangeIntEqual {
+        using is_transparent = void;
+        bool operator()(const StrangeInt& lhs, const StrangeInt& rhs) const {
+            return lhs == rhs;
+        }
+        bool operator()(const StrangeInt& lhs, int rhs) const {
+            return lhs.x == rhs;
+        }
+    };
+
+    void check_transparent() {
+        std::cerr << "check transparent lookup... ";
+        HashMap<StrangeInt, int, StrangeIntHash, StrangeIntEqual> map;
+        for (int i = 0; i < 100; ++i)
+            map[StrangeInt(i)] = i;
+        StrangeInt::init();
+        for (int i = 0; i < 200; ++i) {
+            if (map.contains(i) != (i < 100) || map.count(i) != (i < 100))
+                fail("wrong transparent contains");
+            if (i < 100 && (map.find(i)->second != i || map.at(i) != i))
+                fail("wrong transparent find");
+        }
+        if (StrangeInt::counter != 0)
+            fail("transparent lookup builds keys");
+        map.erase(5);
+        if (StrangeInt::counter != -1)
+            fail("transparent erase builds keys");
+        if (map.size() != 99 || map.contains(5))
+            fail("wrong transparent erase");
+
+        HashMap<int, int> plain{{1, 2}};
+        if (!plain.contains(1) || plain.count(2) != 0)
+            fail("wrong contains");
+        std::cerr << "ok!\n";
+    }
+
+/* check that cached hashes are reused by rehash */
+    struct CountingHash {
+        static int calls;
+        size_t operator()(const std::string& s) const {
+            ++calls;
+            return std::hash<std::string>()(s);
+        }
+    };
+    int CountingHash::calls;
+
+    template <class Storage>
+    void check_stored_hash() {
+        std::cerr << "check stored hash... ";
+        static_assert(default_store_hash<std::string>::value && !default_store_hash<int>::value,
+                "wrong default hash caching");
+        HashMap<std::string, int, CountingHash, std::equal_to<std::string>, Storage> map;
+        for (int i = 0; i < 1000; ++i)
+            map[std::to_string(i)] = i;
+        CountingHash::calls = 0;
+        map.reserve(100000);
+        map.erase("5");
+        if (CountingHash::calls != 1)
+            fail("rehash calls the hasher");
+        for (int i = 0; i < 1000; ++i)
+            if (map.contains(std::to_string(i)) != (i != 5) || (i != 5 && map.at(std::to_string(i)) != i))
+                fail("wrong find with stored hash");
+        HashMap<std::string, int, CountingHash, std::equal_to<std::string>, Storage> copy(map);
+        if (copy.size() != 999 || copy.at("999") != 999)
+            fail("wrong copy with stored hash");
+        std::cerr << "ok!\n";
+    }
+
+/* check incremental rehash against std::map */
+    void check_incremental() {
+        std::cerr << "check incremental rehash... ";
+        IncrementalHashMap<int, int> map;
+        std::map<int, int> expected;
+        bool was_rehashing = false;
+        srand(239);
+        for (int i = 0; i < 100000; ++i) {
+            int key = rand() % 50000;
+            int op = rand() % 4;
+            if (op < 2) {
+                map[key] = i;
+                expected[key] = i;
+            } else if (op == 2) {
+                map.erase(key);
+                expected.erase(key);
+            } else {
+                auto it = map.find(key);
+                auto exp_it = expected.find(key);
+                if ((it == map.end()) != (exp_it == expected.end()))
+                    fail("find disagrees with std::map");
+                if (it != map.end() && it->second != exp_it->second)
+                    fail("wrong value found");
+            }
+            was_rehashing |= map.is_rehashing();
+            if (map.size() != expected.size())
+                fail("wrong size");
+        }
+        if (!was_rehashing)
+            fail("table never rehashed incrementally");
+        size_t visited = 0;
+        const auto& const_map = map;
+        for (auto cur : const_map) {
+            if (expected.at(cur.first) != cur.second || const_map.at(cur.first) != cur.second)
+                fail("wrong value in iteration");
+            ++visited;
+        }
+        if (visited != expected.size())
+            fail("wrong iteration");
+        map.finish_rehash();
+        if (map.is_rehashing() || map.size() != expected.size())
+            fail("wrong finish_rehash");
+        IncrementalHashMap<std::string, int> strings;
+        for (int i = 0; i < 10000; ++i) {
+            std::string key = std::to_string(i % 5000);
+            auto result = strings.insert_or_assign(std::move(key), i);
+            if (result.second != (i < 5000) || result.first->second != i)
+                fail("wrong insert_or_assign with a moved key");
+            if (strings.is_rehashing())
+                ++strings.at(std::to_string(i / 2 % 5000));
+        }
+        for (int i = 0; i < 5000; ++i) {
+            strings.at(std::to_string(i)) = -i;
+            if (strings.at(std::to_string(i)) != -i)
+                fail("wrong assignment through at");
+        }
+        bool thrown = false;
+        try {
+            strings.at("missing") = 1;
+        } catch (const std::out_of_range&) {
+            thrown = true;
+        }
+        if (!thrown || strings.size() != 5000)
+            fail("at doesn't throw on a missing key");
+        std::cerr << "ok!\n";
+    }
+
+/* check that slot arrays come from the map's allocator */
+    template <class T> struct CountingAllocator {
+        using value_type = T;
+        using propagate_on_container_copy_assignment = std::true_type;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+        std::shared_ptr<long> live;
+
+        CountingAllocator() : live(std::make_shared<long>(0)) {}
+        template <class U> CountingAllocator(const CountingAllocator<U>& other) : live(other.live) {}
+
+        T* allocate(size_t n) {
+            *live += n;
+            return std::allocator<T>().allocate(n);
+        }
+        void deallocate(T* p, size_t n) {
+            *live -= n;
+            std::allocator<T>().deallocate(p, n);
+        }
+        template <class U> bool operator ==(const CountingAllocator<U>& other) const {
+            return live == other.live;
+        }
+        template <class U> bool operator !=(const CountingAllocator<U>& other) const {
+            return live != other.live;
+        }
+    };
+
+    template <class Storage>
+    void check_allocator() {
+        std::cerr << "check allocators... ";
+        using Alloc = CountingAllocator<std::pair<const std::string, int>>;
+        Alloc alloc;
+        {
+            HashMap<std::string, int, std::hash<std::string>, std::equal_to<std::string>, Storage, true, Alloc> map(alloc);
+            for (int i = 0; i < 1000; ++i)
+                map[std::to_string(i)] = i;
+            if (*alloc.live == 0 || map.get_allocator() != alloc)
+                fail("allocator not used");
+            auto copy = map;
+            copy.clear();
+            copy.rehash(4096);
+            if (copy.get_allocator() != alloc)
+                fail("allocator lost on clear or rehash");
+            copy = map;
+            if (copy.size() != 1000 || copy.at("999") != 999)
+                fail("wrong copy with allocator");
+        }
+        if (*alloc.live != 0)
+            fail("slots not returned to allocator");
+
+        // every allocation must come from the arena, the default resource refuses all of them
+        static char buffer[1 << 20];
+        std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+        std::pmr::memory_resource* old_default = std::pmr::set_default_resource(std::pmr::null_memory_resource());
+        {
+            hash_map_pmr::HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage> map(&arena);
+            for (int i = 0; i < 1000; ++i)
+                map[i] = i;
+            hash_map_pmr::HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage> copy(map, &arena);
+            copy.clear();
+            copy = map;
+            if (copy.size() != 1000 || copy.at(999) != 999)
+                fail("wrong map in arena");
+            hash_map_pmr::HashSet<int, std::hash<int>, std::equal_to<int>, Storage> set(&arena);
+            for (int i = 0; i < 1000; ++i)
+                set.insert(i * 7);
+            if (set.size() != 1000 || !set.contains(6993))
+                fail("wrong set in arena");
+        }
+        std::pmr::set_default_resource(old_default);
+
+        HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage, false,
+                AlignedAllocator<std::pair<const int, int>>> aligned;
+        HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage, false,
+                HugePageAllocator<std::pair<const int, int>>> huge(1 << 18);
+        for (int i = 0; i < 100000; ++i) {
+            aligned[i] = i;
+            huge[i] = i;
+        }
+        for (int i = 0; i < 100000; ++i)
+            if (aligned.at(i) != i || huge.at(i) != i)
+                fail("wrong map with aligned allocators");
+        char* line = AlignedAllocator<char>().allocate(1);
+        int* page = HugePageAllocator<int>().allocate(3 << 20);
+        if (reinterpret_cast<uintptr_t>(line) % 64 != 0 ||
+            reinterpret_cast<uintptr_t>(page) % HugePageAllocator<int>::kHugePage != 0)
+            fail("wrong alignment");
+        page[(3 << 20) - 1] = 1;
+        AlignedAllocator<char>().deallocate(line, 1);
+        HugePageAllocator<int>().deallocate(page, 3 << 20);
+        std::cerr << "ok!\n";
+    }
+
+/* check concurrent map: readers never see a value that wasn't written for the key */
+    void check_concurrent() {
+        std::cerr << "check concurrent map... ";
+        ConcurrentHashMap<int, long long, std::hash<int>, std::equal_to<int>, 8> map;
+        long long found;
+        // segments that were never written have no buckets
+        if (map.find(42, found) || map.contains(0) || map.find(7).has_value() || map.erase(42))
+            fail("found a key in an empty concurrent map");
+        std::map<int, long long> expected;
+        srand(57);
+        for (int i = 0; i < 20000; ++i) {
+            int key = rand() % 5000;
+            if (rand() % 3) {
+                if (map.insert_or_assign(key, i) != !expected.count(key))
+                    fail("wrong insert_or_assign result");
+                expected[key] = i;
+            } else if (map.erase(key) != (expected.erase(key) == 1)) {
+                fail("wrong erase result");
+            }
+        }
+        if (map.size() != expected.size())
+            fail("wrong concurrent size");
+        size_t visited = 0;
+        map.for_each([&](int key, long long value) {
+            if (expected.at(key) != value)
+                fail("wrong value in for_each");
+            ++visited;
+        });
+        if (visited != expected.size())
+            fail("wrong for_each");
+        map.clear();
+        if (!map.empty() || map.contains(0))
+            fail("wrong concurrent clear");
+
+        // writers store key * 1000 + round, readers check the key part
+        const int keys = 20000;
+        std::atomic<bool> stop{false};
+        std::atomic<bool> bad{false};
+        std::vector<std::thread> threads;
+        for (int w = 0; w < 2; ++w) {
+            threads.emplace_back([&, w]() {
+                for (int round = 0; round < 5; ++round) {
+                    for (int key = w; key < keys; key += 2) {
+                        map.insert_or_assign(key, key * 1000LL + round);
+                    }
+                    for (int key = w; key < keys; key += 6) {
+                        map.erase(key);
+                    }
+                }
+            });
+        }
+        for (int r = 0; r < 4; ++r) {
+            threads.emplace_back([&, r]() {
+                int key = r;
+                while (!stop.load()) {
+                    auto value = map.find(key);
+                    if (value && *value / 1000 != key)
+                        bad = true;
+                    key = (key + 7) % keys;
+                }
+            });
+        }
+        for (int w = 0; w < 2; ++w)
+            threads[w].join();
+        stop = true;
+        for (size_t t = 2; t < threads.size(); ++t)
+            threads[t].join();
+        if (bad)
+            fail("reader saw a torn value");
+        for (int key = 0; key < keys; ++key) {
+            auto value = map.find(key);
+            if (value.has_value() == (key % 6 < 2) || (value && *value != key * 1000LL + 4))
+                fail("wrong state after concurrent writes");
+        }
+        std::cerr << "ok!\n";
+    }
+
+/* check sharded map against std::map, then with concurrent writers */
+    void check_sharded() {
+        std::cerr << "check sharded map... ";
+        ShardedHashMap<std::string, int> map{{"a", 1}, {"b", 2}};
+        std::map<std::string, int> expected{{"a", 1}, {"b", 2}};
+        srand(91);
+        for (int i = 0; i < 20000; ++i) {
+            std::string key = std::to_string(rand() % 3000);
+            if (rand() % 3) {
+                map[key] = i;
+                expected[key] = i;
+            } else {
+                map.erase(key);
+                expected.erase(key);
+            }
+        }
+        if (map.size() != expected.size())
+            fail("wrong sharded size");
+        size_t visited = 0;
+        const auto& const_map = map;
+        for (const auto& cur : const_map) {
+            if (expected.at(cur.first) != cur.second || const_map.at(cur.first) != cur.second)
+                fail("wrong value in sharded iteration");
+            ++visited;
+        }
+        if (visited != expected.size())
+            fail("wrong sharded iteration");
+        if (map.find("missing") != map.end() || map.find(expected.begin()->first)->second != expected.begin()->second)
+            fail("wrong sharded find");
+        map.clear();
+        if (!map.empty() || map.begin() != map.end())
+            fail("wrong sharded clear");
+
+        // every thread bumps every counter once
+        ShardedHashMap<int, int, std::hash<int>, 8> counters;
+        std::vector<std::thread> threads;
+        std::atomic<bool> found_missing{false};
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t]() {
+                for (int i = 0; i < 20000; ++i) {
+                    counters.upsert((i * 7 + t * 13) % 20000, [](int& value) {
+                        ++value;
+                    });
+                    // end() doesn't read the shards other writers are changing
+                    if (counters.find(-1 - i) != counters.end())
+                        found_missing = true;
+                }
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        if (found_missing)
+            fail("found a missing key");
+        size_t keys = 0;
+        counters.for_each([&](int, int value) {
+            if (value != 4)
+                fail("lost concurrent update");
+            ++keys;
+        });
+        int value = 0;
+        if (keys != 20000 || !counters.visit(19999, [&](int cur) { value = cur; }) || value != 4)
+            fail("wrong concurrent upserts");
+        std::cerr << "ok!\n";
+    }
+
+/* check that batched operations agree with one by one ones */
+    template <class Storage>
+    void check_batch() {
+        std::cerr << "check batched operations... ";
+        using Map = HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage>;
+        Map map, expected;
+        std::vector<std::pair<int, int>> keyvalues;
+        srand(17);
+        for (int i = 0; i < 3001; ++i)
+            keyvalues.push_back({rand() % 5000, i});
+        size_t inserted = 0;
+        for (const auto& keyvalue : keyvalues)
+            inserted += expected.try_emplace(keyvalue.first, keyvalue.second).second;
+        if (map.insert_batch(keyvalues.data(), keyvalues.size()) != inserted || map.size() != expected.size())
+            fail("wrong insert_batch");
+        std::vector<int> keys;
+        for (int i = 0; i < 1003; ++i)
+            keys.push_back(rand() % 10000);
+        std::vector<typename Map::iterator> found(keys.size());
+        std::vector<typename Map::const_iterator> const_found(keys.size());
+        std::unique_ptr<bool[]> contained(new bool[keys.size()]);
+        map.find_batch(keys.data(), keys.size(), found.data());
+        static_cast<const Map&>(map).find_batch(keys.data(), keys.size(), const_found.data());
+        map.contains_batch(keys.data(), keys.size(), contained.get());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            auto it = expected.find(keys[i]);
+            if (found[i] != map.find(keys[i]) || const_found[i] != typename Map::const_iterator(found[i]) || contained[i] != (it != expected.end()))
+                fail("batched lookup disagrees with find");
+            if (it != expected.end() && found[i]->second != it->second)
+                fail("wrong value in batched lookup");
+        }
+        std::cerr << "ok!\n";
+    }
+
+/* check parallel bulk build and rehash against serial ones */
+    template <class Storage, class Hasher>
+    void check_parallel_build() {
+        std::cerr << "check parallel build... ";
+        using Map = HashMap<int, int, Hasher, std::equal_to<int>, Storage>;
+        std::vector<std::pair<int, int>> keyvalues;
+        srand(73);
+        for (int i = 0; i < 300000; ++i)
+            keyvalues.push_back({rand() % 200000, i});
+        Map serial(keyvalues.data(), keyvalues.data() + keyvalues.size(), 0, 1);
+        Map parallel(keyvalues.data(), keyvalues.data() + keyvalues.size(), 0, 4);
+        if (serial.size() != parallel.size() || parallel.bucket_count() != serial.bucket_count())
+            fail("wrong parallel build size");
+        for (const auto& cur : serial)
+            if (parallel.at(cur.first) != cur.second)
+                fail("parallel build keeps a wrong duplicate");
+        Map copied(serial.begin(), serial.end(), 0, 3);
+        if (copied.size() != serial.size() || copied.at(keyvalues[0].first) != serial.at(keyvalues[0].first))
+            fail("wrong parallel build from iterators");
+        parallel.rehash(parallel.bucket_count() * 4);
+        parallel.build_threads(0);
+        for (int i = 200000; i < 500000; ++i)
+            parallel[i] = i;
+        for (const auto& cur : serial)
+            if (parallel.at(cur.first) != cur.second)
+                fail("wrong parallel rehash");
+        if (parallel.size() != serial.size() + 300000 || parallel.at(499999) != 499999)
+            fail("wrong size after parallel rehash");
+        std::cerr << "ok!\n";
+    }
+
+/* check that a saved snapshot maps back with the same contents */
+    template <class Storage>
+    void check_snapshot() {
+        std::cerr << "check snapshots... ";
+        using Map = HashMap<long long, int, BadHash, std::equal_to<long long>, Storage>;
+        Map map;
+        srand(29);
+        for (int i = 0; i < 20000; ++i)
+            map[rand() % 100000] = i;
+        std::string path = "hash_map_snapshot_test.bin";
+        save_snapshot(map, path);
+        {
+            MappedHashMap<long long, int, BadHash> mapped(path);
+            if (mapped.size() != map.size() || mapped.bucket_count() != map.bucket_count())
+                fail("wrong mapped size");
+            for (long long key = 0; key < 100000; ++key) {
+                auto it = map.find(key);
+                if (mapped.contains(key) != (it != map.end()) || (it != map.end() && mapped.at(key) != it->second))
+                    fail("mapped lookup disagrees with the map");
+            }
+            size_t visited = 0;
+            for (const auto& cur : mapped) {
+                if (map.at(cur.first) != cur.second)
+                    fail("wrong value in mapped iteration");
+                ++visited;
+            }
+            if (visited != map.size() || mapped.find(-1) != mapped.end())
+                fail("wrong mapped iteration");
+        }
+        Map loaded = load_snapshot<Map>(path);
+        if (loaded.size() != map.size() || loaded.at(map.begin()->first) != map.begin()->second)
+            fail("wrong loaded snapshot");
+        try {
+            MappedHashMap<long long, int> other_hash(path);
+            fail("snapshot of another hash accepted");
+        } catch (std::runtime_error&) {}
+        try {
+            MappedHashMap<int, int, BadHash> other_types(path);
+            fail("snapshot of other types accepted");
+        } catch (std::runtime_error&) {}
+
+        // seeded hashers are rebuilt from the saved seed
+        using Seeded = HashMap<long long, int, FastHash<long long>, std::equal_to<long long>, Storage>;
+        Seeded seeded(FastHash<long long>::randomized());
+        HashMap<long long, int, SeededHash<std::hash<long long>>> post_mixed(SeededHash<std::hash<long long>>(17));
+        for (int i = 0; i < 1000; ++i) {
+            seeded[i * 7] = i;
+            post_mixed[i * 7] = i;
+        }
+        save_snapshot(seeded, path);
+        {
+            MappedHashMap<long long, int, FastHash<long long>> mapped(path);
+            Seeded loaded_seeded = load_snapshot<Seeded>(path);
+            if (mapped.hash_function().seed() != seeded.hash_function().seed() ||
+                loaded_seeded.hash_function().seed() != seeded.hash_function().seed() ||
+                mapped.at(6993) != 999 || loaded_seeded.size() != 1000 || loaded_seeded.at(7) != 1)
+                fail("wrong snapshot of a randomized hasher");
+        }
+        save_snapshot(post_mixed, path);
+        if (load_snapshot<decltype(post_mixed)>(path).at(14) != 2)
+            fail("wrong snapshot of a seeded hasher");
+
+        // every header field locating the slots is checked
+        std::string saved;
+        {
+            std::ifstream in(path, std::ios::binary);
+            saved.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        using hash_map_detail::SnapshotHeader;
+        const std::pair<size_t, uint64_t> corruptions[] = {
+            {offsetof(SnapshotHeader, buffer_size), 3},
+            {offsetof(SnapshotHeader, buffer_size), uint64_t(1) << 62},
+            {offsetof(SnapshotHeader, meta_offset), 0},
+            {offsetof(SnapshotHeader, pairs_offset), 8},
+            {offsetof(SnapshotHeader, pairs_offset), saved.size() - 1},
+            {offsetof(SnapshotHeader, count), uint64_t(1) << 40},
+        };
+        for (const auto& corruption : corruptions) {
+            std::string broken = saved;
+            std::memcpy(&broken[corruption.first], &corruption.second, sizeof(uint64_t));
+            std::ofstream(path, std::ios::binary | std::ios::trunc).write(broken.data(), broken.size());
+            try {
+                MappedHashMap<long long, int, SeededHash<std::hash<long long>>> mapped(path);
+                fail("broken snapshot accepted");
+            } catch (std::runtime_error&) {}
+        }
+        // a truncated file
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(saved.data(), saved.size() / 2);
+        try {
+            MappedHashMap<long long, int, SeededHash<std::hash<long long>>> mapped(path);
+            fail("truncated snapshot accepted");
+        } catch (std::runtime_error&) {}
+        std::remove(path.c_str());
+        std::cerr << "ok!\n";
+    }
+
+/* check frozen map lookups and its probe bound */
+    template <class Hasher>
+    void check_frozen() {
+        std::cerr << "check frozen map... ";
+        HashMap<int, int, Hasher> map;
+        srand(101);
+        for (int i = 0; i < 30000; ++i)
+            map[rand() % 100000] = i;
+        FrozenHashMap<int, int, Hasher> frozen(map, 4);
+        FrozenHashMap<int, int, Hasher> loose(map, 100);
+        if (frozen.size() != map.size() || loose.bucket_count() > frozen.bucket_count())
+            fail("wrong frozen size");
+        if (std::is_same<Hasher, std::hash<int>>::value && (frozen.max_psl() > 4 || loose.bucket_count() > 65536))
+            fail("frozen map misses its target PSL");
+        for (int key = -10; key < 100000; ++key) {
+            auto it = map.find(key);
+            if (frozen.contains(key) != (it != map.end()) || loose.count(key) != frozen.count(key))
+                fail("frozen lookup disagrees with the map");
+            if (it != map.end() && (frozen.at(key) != it->second || loose.find(key)->second != it->second))
+                fail("wrong frozen value");
+        }
+        size_t visited = 0;
+        for (const auto& cur : frozen) {
+            if (map.at(cur.first) != cur.second)
+                fail("wrong value in frozen iteration");
+            ++visited;
+        }
+        if (visited != map.size())
+            fail("wrong frozen iteration");
+        FrozenHashMap<int, int, Hasher> empty(HashMap<int, int, Hasher>{});
+        if (!empty.empty() || empty.contains(0) || empty.begin() != empty.end())
+            fail("wrong empty frozen map");
+        std::cerr << "ok!\n";
+    }
+
+/* check that max_psl bounds lookups: long runs, misses and erasures */
+    template <class Storage>
+    void check_max_psl() {
+        std::cerr << "check max psl... ";
+        HashMap<int, int, BadHash, std::equal_to<int>, Storage> map;
+        if (map.max_psl() != 0 || map.contains(0))
+            fail("wrong max psl of empty map");
+        // 300 keys share a hash, the run outgrows the saturated metadata
+        for (int i = 0; i < 600; ++i)
+            map[i] = i;
+        if (map.max_psl() < 299 || map.max_psl() >= map.bucket_count())
+            fail("wrong max psl of a long run");
+        for (int key = -300; key < 1200; ++key) {
+            if (map.contains(key) != (key >= 0 && key < 600))
+                fail("bounded lookup disagrees");
+        }
+        size_t bound = map.max_psl();
+        for (int i = 0; i < 600; i += 2)
+            map.erase(i);
+        if (map.max_psl() != bound)
+            fail("erase changed max psl");
+        for (int key = -300; key < 1200; ++key) {
+            if (map.contains(key) != (key >= 0 && key < 600 && key % 2))
+                fail("bounded lookup disagrees after erase");
+        }
+        map.rehash(map.bucket_count() * 2);
+        if (map.max_psl() >= bound || map.max_psl() < 149)
+            fail("rehash didn't recompute max psl");
+        HashMap<int, int, BadHash, std::equal_to<int>, Storage> copy(map);
+        HashMap<int, int, BadHash, std::equal_to<int>, Storage> moved(std::move(map));
+        if (copy.max_psl() != moved.max_psl() || map.max_psl() != 0 || !copy.contains(599) || !moved.contains(1))
+            fail("max psl not carried over");
+        HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage> spread;
+        srand(4242);
+        for (int i = 0; i < 100000; ++i)
+            spread[rand()] = i;
+        if (spread.max_psl() > 64)
+            fail("max psl too large for a good hash");
+        spread.clear();
+        if (spread.max_psl() != 0)
+            fail("clear kept max psl");
+        std::cerr << "ok!\n";
+    }
+
+/* check occupancy statistics, a bad hash must stand out */
+    template <class Storage>
+    void check_stats() {
+        std::cerr << "check stats... ";
+        HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage> good;
+        HashMap<int, int, std::function<size_t(int)>, std::equal_to<int>, Storage> bad(stupid_hash);
+        for (int i = 0; i < 1000; ++i) {
+            good[i * 7] = i;
+            bad[i * 7] = i;
+        }
+        HashMapStats good_stats = good.stats();
+        HashMapStats bad_stats = bad.stats();
+        if (good_stats.size != 1000 || good_stats.capacity != good.bucket_count() || good_stats.tombstones != 0 ||
+            good_stats.load_factor != 1000.0 / good.bucket_count() || good_stats.max_load_factor != 0.5)
+            fail("wrong occupancy");
+        size_t total = 0;
+        for (size_t count : good_stats.psl_histogram)
+            total += count;
+        if (total != 1000 || good_stats.psl_histogram.size() != good_stats.max_psl + 1 ||
+            good_stats.max_psl > good.max_psl())
+            fail("wrong psl histogram");
+        if (bad_stats.max_psl != 999 || bad_stats.mean_psl != 499.5 || good_stats.mean_psl > 2)
+            fail("wrong psl summary");
+        if (good_stats.rehashes == 0 || good_stats.rehash_seconds < 0)
+            fail("rehashes not counted");
+#if defined(HASH_MAP_STATS)
+        good.reset_stats();
+        for (int i = 0; i < 1000; ++i)
+            good.count(i);
+        good.try_emplace(-1, 0);
+        good_stats = good.stats();
+        if (good_stats.lookups != 1000 || good_stats.lookup_probes < 1000 || good_stats.inserts != 1 ||
+            good_stats.insert_probes == 0)
+            fail("probes not counted");
+        if (!bad.contains(0) || bad.stats().lookup_probes < 1)
+            fail("probes of a bad hash not counted");
+#else
+        if (sizeof(hash_map_detail::Counters) != sizeof(size_t) + sizeof(double))
+            fail("probe counters kept without HASH_MAP_STATS");
+#endif
+        good.reset_stats();
+        good.clear();
+        good_stats = good.stats();
+        if (good_stats.rehashes != 0 || good_stats.size != 0 || !good_stats.psl_histogram.empty() ||
+            good_stats.mean_psl != 0)
+            fail("wrong stats after reset");
+        std::cerr << "ok!\n";
+    }
+
+/* check iteration, for_each and chunked for_each on sparse and dense tables */
+    template <class Storage>
+    void check_for_each() {
+        std::cerr << "check for_each... ";
+        for (int n : {0, 1, 7, 100, 5000}) {
+            HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage> map;
+            map.reserve(n * 4);
+            std::map<int, int> expected;
+            for (int i = 0; i < n; ++i) {
+                map[i * 13] = i;
+                expected[i * 13] = i;
+            }
+            for (int i = 0; i < n; i += 3) {
+                map.erase(i * 13);
+                expected.erase(i * 13);
+            }
+            std::map<int, int> iterated;
+            for (const auto& cur : map)
+                iterated[cur.first] += cur.second + 1;
+            std::map<int, int> visited;
+            map.for_each([&](const int& key, int& value) {
+                visited[key] += value + 1;
+                ++value;
+            });
+            if (iterated.size() != expected.size() || visited != iterated)
+                fail("for_each and iteration disagree");
+            for (const auto& cur : expected) {
+                if (iterated[cur.first] != cur.second + 1 || map.at(cur.first) != cur.second + 1)
+                    fail("wrong iterated value");
+            }
+            const auto& const_map = map;
+            for (size_t chunks : {1, 2, 3, 64, 100000}) {
+                std::map<int, int> chunked;
+                for (size_t chunk = 0; chunk < chunks; ++chunk) {
+                    const_map.for_each_chunk(chunk, chunks, [&](const int& key, const int& value) {
+                        chunked[key] += value;
+                    });
+                }
+                if (chunked.size() != expected.size())
+                    fail("chunks miss elements");
+                for (const auto& cur : expected) {
+                    if (chunked[cur.first] != cur.second + 1)
+                        fail("chunks visit an element twice");
+                }
+            }
+            if (!map.empty()) {
+                map.for_each_chunk(5, 4, [&](const int&, int&) {
+                    fail("chunk past the last one isn't empty");
+                });
+            }
+        }
+        HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage> big;
+        for (int i = 0; i < 100000; ++i)
+            big[i] = 1;
+        std::vector<long long> sums(4);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < sums.size(); ++t) {
+            threads.emplace_back([&, t] {
+                big.for_each_chunk(t, sums.size(), [&](const int& key, const int& value) {
+                    sums[t] += key + value;
+                });
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        if (sums[0] + sums[1] + sums[2] + sums[3] != 100000LL * 99999 / 2 + 100000)
+            fail("wrong parallel export");
+        std::cerr << "ok!\n";
+    }
+
+/* check that clear keeps the capacity and shrink_to_fit gives it back */
+    template <class Storage>
+    void check_clear() {
+        std::cerr << "check clear... ";
+        HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage> map;
+        for (int round = 0; round < 3; ++round) {
+            for (int i = 0; i < 10000; ++i)
+                map[i * 3 + round] = i;
+            size_t buckets = map.bucket_count();
+            size_t rehashes = map.stats().rehashes;
+            map.clear();
+            if (!map.empty() || map.bucket_count() != buckets || map.begin() != map.end() || map.contains(round))
+                fail("wrong clear");
+            for (int i = 0; i < 10000; ++i)
+                map[i] = i;
+            if (map.stats().rehashes != rehashes || map.size() != 10000 || map.at(9999) != 9999)
+                fail("refill after clear grew the table");
+            map.clear();
+        }
+        map.shrink_to_fit();
+        if (map.bucket_count() != 0 || !map.empty() || map.contains(0) || map.begin() != map.end())
+            fail("wrong shrink of an empty map");
+        for (int i = 0; i < 10000; ++i)
+            map[i] = i;
+        for (int i = 100; i < 10000; ++i)
+            map.erase(i);
+        map.shrink_to_fit();
+        if (map.bucket_count() != 256 || map.size() != 100 || map.at(99) != 99 || map.contains(100))
+            fail("wrong shrink_to_fit");
+
+        StrangeInt::init();
+        {
+            HashMap<StrangeInt, int, std::hash<StrangeInt>, std::equal_to<StrangeInt>, Storage> strange;
+            for (int i = 0; i < 1000; ++i)
+                strange[i] = i;
+            strange.clear();
+            if (StrangeInt::counter)
+                fail("clear didn't destroy the elements");
+            strange[5] = 5;
+            if (strange.size() != 1 || strange.at(5) != 5)
+                fail("wrong insert after clear");
+        }
+        if (StrangeInt::counter)
+            fail("wrong destructor after clear");
+        std::cerr << "ok!\n";
+    }
+
+/* compare small map with std::map around the spill, check that empty maps allocate nothing */
+    void check_small() {
+        std::cerr << "check small map... ";
+        srand(777);
+        for (int run = 0; run < 50; ++run) {
+            SmallHashMap<std::string, int, 4> map;
+            std::map<std::string, int> expected;
+            int keys = run % 2 ? 6 : 30;
+            size_t largest = 0;
+            for (int i = 0; i < 200; ++i) {
+                std::string key = std::to_string(rand() % keys);
+                int op = rand() % 4;
+                if (op == 0) {
+                    map[key] = i;
+                    expected[key] = i;
+                } else if (op == 1) {
+                    map.erase(key);
+                    expected.erase(key);
+                } else if (op == 2) {
+                    if (map.contains(key) != (expected.count(key) > 0))
+                        fail("wrong small contains");
+                } else {
+                    map.insert_or_assign(key, -i);
+                    expected[key] = -i;
+                }
+                largest = std::max(largest, expected.size());
+                if (map.size() != expected.size() || map.is_inline() != (largest <= 4))
+                    fail("wrong small size");
+            }
+            std::map<std::string, int> iterated(map.begin(), map.end());
+            if (iterated != expected)
+                fail("wrong small iteration");
+            SmallHashMap<std::string, int, 4> copy(map);
+            SmallHashMap<std::string, int, 4> moved(std::move(copy));
+            if (!copy.empty() || moved.size() != map.size() || std::map<std::string, int>(moved.begin(), moved.end()) != expected)
+                fail("wrong small copy");
+            copy = moved;
+            for (const auto& cur : expected) {
+                if (copy.at(cur.first) != cur.second || moved.find(cur.first)->second != cur.second)
+                    fail("wrong small value");
+            }
+            copy.clear();
+            if (!copy.empty() || !copy.is_inline() || copy.begin() != copy.end())
+                fail("wrong small clear");
+        }
+
+        StrangeInt::init();
+        {
+            SmallHashMap<StrangeInt, int, 3> strange{{1, 1}, {2, 2}};
+            strange[3] = 3;
+            if (!strange.is_inline())
+                fail("spilled too early");
+            strange[4] = 4;
+            if (strange.is_inline() || strange.size() != 4 || strange.at(1) != 1 || strange.at(4) != 4)
+                fail("wrong spill");
+            strange.erase(2);
+            SmallHashMap<StrangeInt, int, 3> other{{7, 7}};
+            other = strange;
+            if (other.size() != 3 || other.contains(7) || other.contains(2))
+                fail("wrong small assignment");
+        }
+        if (StrangeInt::counter)
+            fail("wrong small destructor");
+        // the spilled table lives behind a pointer
+        if (sizeof(SmallHashMap<int, int, 4>) > 4 * sizeof(std::pair<int, int>) + 3 * sizeof(size_t))
+            fail("small map too large");
+
+        using Alloc = CountingAllocator<std::pair<const int, int>>;
+        Alloc alloc;
+        {
+            HashMap<int, int, std::hash<int>, std::equal_to<int>, NodeStorage, false, Alloc> empty(alloc);
+            HashMap<int, int, std::hash<int>, std::equal_to<int>, NodeStorage, false, Alloc> copy(empty);
+            if (*alloc.live != 0 || empty.bucket_count() != 0 || empty.contains(1) || empty.begin() != empty.end())
+                fail("empty map allocates");
+            empty[1] = 1;
+            if (*alloc.live == 0 || empty.at(1) != 1)
+                fail("wrong first insertion");
+        }
+        std::cerr << "ok!\n";
+    }
+
+/* compare hash set with std::set, check that it stores bare keys */
+    template <class Storage>
+    void check_set() {
+        std::cerr << "check set... ";
+        static_assert(std::is_same<typename HashSet<uint64_t>::KvType, uint64_t>::value, "set stores more than keys");
+        static_assert(std::is_same<decltype(*HashSet<uint64_t>().begin()), const uint64_t&>::value,
+                      "set iterators give mutable keys");
+        srand(4242);
+        HashSet<uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>, Storage> set;
+        std::set<uint64_t> expected;
+        for (int i = 0; i < 100000; ++i) {
+            uint64_t key = rand() % 5000;
+            int op = rand() % 3;
+            if (op == 0) {
+                if (set.insert(key).second != expected.insert(key).second)
+                    fail("wrong set insert");
+            } else if (op == 1) {
+                set.erase(key);
+                expected.erase(key);
+            } else if (set.contains(key) != (expected.count(key) > 0) || set.count(key) != expected.count(key)) {
+                fail("wrong set contains");
+            }
+        }
+        if (set.size() != expected.size() || std::set<uint64_t>(set.begin(), set.end()) != expected)
+            fail("wrong set iteration");
+        std::set<uint64_t> visited;
+        set.for_each([&](uint64_t key) { visited.insert(key); });
+        if (visited != expected)
+            fail("wrong set for_each");
+        auto copy = set;
+        auto moved = std::move(copy);
+        if (!copy.empty() || moved.size() != expected.size() || *moved.find(*expected.begin()) != *expected.begin())
+            fail("wrong set copy");
+
+        HashSet<std::string, std::hash<std::string>, std::equal_to<std::string>, Storage> strings{"a", "b", "a"};
+        std::string c = "c";
+        if (strings.size() != 2 || !strings.insert(std::move(c)).second || strings.insert("c").second ||
+            !strings.emplace("d").second || strings.size() != 4 || strings.find("e") != strings.end())
+            fail("wrong string set");
+
+        StrangeInt::init();
+        {
+            HashSet<StrangeInt, std::hash<StrangeInt>, std::equal_to<StrangeInt>, Storage> strange;
+            for (int i = 0; i < 1000; ++i)
+                strange.insert(i % 700);
+            for (int i = 0; i < 300; ++i)
+                strange.erase(i);
+            if (strange.size() != 400 || strange.contains(1) || !strange.contains(500))
+                fail("wrong strange set");
+        }
+        if (StrangeInt::counter)
+            fail("wrong set destructor");
+        std::cerr << "ok!\n";
+    }
+
+/* check seeded hashers: determinism, seeds, transparency and spreading of strided keys */
+    void check_hashers() {
+        std::cerr << "check hashers... ";
+        FastHash<uint64_t> ints(1);
+        if (ints(4096) != FastHash<uint64_t>(1)(4096) || ints(4096) == FastHash<uint64_t>(2)(4096) ||
+            ints(4096) == ints(8192) || FastHash<uint64_t>()(0) != FastHash<uint64_t>(0)(0))
+            fail("wrong integer hash");
+        FastHash<std::string> strings(7);
+        std::string text(200, 'x');
+        if (strings(text) != strings(std::string_view(text)) || strings("abc") != strings(std::string("abc")) ||
+            strings(text) == FastHash<std::string>(8)(text))
+            fail("wrong string hash");
+        std::set<size_t> hashes;
+        for (size_t len = 0; len <= text.size(); ++len)
+            hashes.insert(strings(std::string_view(text.data(), len)));
+        for (size_t i = 0; i < text.size(); ++i) {
+            std::string changed = text;
+            changed[i] = 'y';
+            hashes.insert(strings(changed));
+        }
+        if (hashes.size() != 2 * text.size() + 1)
+            fail("string hash collides");
+        FastHash<std::string> first = FastHash<std::string>::randomized();
+        FastHash<std::string> second = FastHash<std::string>::randomized();
+        if (first.seed() == second.seed() || first(text) == second(text))
+            fail("randomized hashers share a seed");
+        SeededHash<std::hash<int>> seeded(3);
+        if (seeded(5) != SeededHash<std::hash<int>>(3)(5) || seeded(5) == SeededHash<std::hash<int>>(4)(5))
+            fail("wrong seeded hash");
+
+        HashMap<uint64_t, int, FastHash<uint64_t>> strided(FastHash<uint64_t>::randomized());
+        HashMap<std::string, int, FastHash<std::string>, std::equal_to<>> named;
+        for (int i = 0; i < 100000; ++i) {
+            strided[uint64_t(i) * 4096] = i;
+            named["id:" + std::to_string(i)] = i;
+        }
+        if (strided.stats().mean_psl > 2 || named.stats().mean_psl > 2 || strided.at(4096 * 777) != 777)
+            fail("strided keys cluster");
+        if (named.at(std::string_view("id:12345")) != 12345 || !named.contains("id:99999") || named.contains("id:"))
+            fail("wrong transparent lookup");
+        std::cerr << "ok!\n";
+    }
+
+    // flags allocations from any thread except the owner, for every rebound type
+    struct AllocatingThread {
+        static std::thread::id owner;
+        static std::atomic<bool> foreign;
+    };
+    std::thread::id AllocatingThread::owner;
+    std::atomic<bool> AllocatingThread::foreign{false};
+
+    template <class T> struct ThreadCheckingAllocator {
+        using value_type = T;
+
+        ThreadCheckingAllocator() = default;
+        template <class U> ThreadCheckingAllocator(const ThreadCheckingAllocator<U>&) {}
+
+        T* allocate(size_t n) {
+            if (std::this_thread::get_id() != AllocatingThread::owner)
+                AllocatingThread::foreign = true;
+            return std::allocator<T>().allocate(n);
+        }
+        void deallocate(T* p, size_t n) {
+            std::allocator<T>().deallocate(p, n);
+        }
+        template <class U> bool operator ==(const ThreadCheckingAllocator<U>&) const {
+            return true;
+        }
+        template <class U> bool operator !=(const ThreadCheckingAllocator<U>&) const {
+            return false;
+        }
+    };
+
+/* check that stable storage keeps element addresses across growth, erasure and migration */
+    void check_stable() {
+        std::cerr << "check stable storage... ";
+        using Big = std::array<char, 1024>;
+        HashMap<int, Big, std::hash<int>, std::equal_to<int>, StableStorage> map;
+        std::vector<const std::pair<const int, Big>*> addresses;
+        for (int i = 0; i < 5000; ++i) {
+            auto it = map.try_emplace(i).first;
+            it->second.fill(static_cast<char>(i));
+            addresses.push_back(&*it);
+        }
+        for (int i = 0; i < 5000; i += 2)
+            map.erase(i);
+        map.rehash(1 << 15);
+        for (int i = 1; i < 5000; i += 2) {
+            auto it = map.find(i);
+            if (&*it != addresses[i] || &map.at(i) != &addresses[i]->second || it->second[1023] != static_cast<char>(i))
+                fail("stable element moved");
+        }
+        auto copy = map;
+        if (copy.size() != 2500 || &copy.at(1) == &map.at(1) || copy.at(4999)[0] != static_cast<char>(4999))
+            fail("wrong stable copy");
+        const Big* third = &map.at(3);
+        auto moved = std::move(map);
+        if (&moved.at(3) != third)
+            fail("stable element moved with the map");
+
+        // nodes of a large range build are allocated by the calling thread only
+        using Alloc = ThreadCheckingAllocator<std::pair<const int, int>>;
+        AllocatingThread::owner = std::this_thread::get_id();
+        std::vector<std::pair<int, int>> pairs;
+        for (int i = 0; i < 300000; ++i)
+            pairs.emplace_back(i, i);
+        HashMap<int, int, std::hash<int>, std::equal_to<int>, StableStorage, false, Alloc> built(
+                pairs.data(), pairs.data() + pairs.size(), 0, 4);
+        if (built.size() != pairs.size() || built.at(299999) != 299999 || AllocatingThread::foreign)
+            fail("stable nodes allocated by build threads");
+
+        IncrementalHashMap<int, std::string, std::hash<int>, std::equal_to<int>, StableStorage> incremental;
+        std::vector<const std::string*> values;
+        for (int i = 0; i < 20000; ++i) {
+            incremental[i] = std::to_string(i);
+            values.push_back(&incremental.at(i));
+        }
+        for (int i = 0; i < 20000; ++i)
+            if (&incremental.at(i) != values[i] || *values[i] != std::to_string(i))
+                fail("element moved by migration");
+
+        StrangeInt::init();
+        {
+            HashMap<StrangeInt, StrangeInt, std::hash<StrangeInt>, std::equal_to<StrangeInt>, StableStorage> strange;
+            for (int i = 0; i < 1000; ++i)
+                strange[i] = i;
+            for (int i = 0; i < 1000; i += 3)
+                strange.erase(i);
+            auto strange_copy = strange;
+            strange.clear();
+            strange[1] = 1;
+        }
+        if (StrangeInt::counter)
+            fail("wrong stable destructor");
+        std::cerr << "ok!\n";
+    }
+
+/* check sentinel storage: integer keys around the reserved one, sets and pointer keys */
+    void check_sentinel() {
+        std::cerr << "check sentinel storage... ";
+        IntHashMap<uint64_t, uint32_t> map;
+        std::map<uint64_t, uint32_t> expected;
+        srand(2718);
+        for (int i = 0; i < 50000; ++i) {
+            uint64_t key = rand() % 2 ? rand() % 4000 : ~uint64_t(0) - 1 - rand() % 4000;
+            int op = rand() % 3;
+            if (op == 0) {
+                map[key] = i;
+                expected[key] = i;
+            } else if (op == 1) {
+                map.erase(key);
+                expected.erase(key);
+            } else if (map.contains(key) != (expected.count(key) > 0) ||
+                       (map.contains(key) && map.at(key) != expected[key])) {
+                fail("wrong sentinel lookup");
+            }
+        }
+        if (map.size() != expected.size() || std::map<uint64_t, uint32_t>(map.begin(), map.end()) != expected)
+            fail("wrong sentinel iteration");
+        size_t size = map.size();
+        try {
+            map[~uint64_t(0)] = 1;
+            fail("empty key inserted");
+        } catch (const std::invalid_argument&) {
+        }
+        if (map.size() != size || map.contains(~uint64_t(0)) || map.find(~uint64_t(0)) != map.end())
+            fail("failed insert changed the map");
+        // a full table isn't grown for the empty key
+        IntHashMap<int, int> full;
+        for (int i = 0; i < 8; ++i)
+            full[i] = i;
+        size_t buckets = full.bucket_count();
+        const int empty_key = std::numeric_limits<int>::max();
+        std::pair<int, int> batch[] = {{100, 1}, {empty_key, 1}};
+        HashSet<int, std::hash<int>, std::equal_to<int>, SentinelStorage<-1>> full_set;
+        for (int i = 0; i < 8; ++i)
+            full_set.insert(i);
+        for (int attempt = 0; attempt < 4; ++attempt) {
+            try {
+                if (attempt == 0)
+                    full[empty_key] = 1;
+                else if (attempt == 1)
+                    full.emplace(empty_key, 1);
+                else if (attempt == 2)
+                    full.insert_batch(batch, 2);
+                else
+                    full_set.emplace(-1);
+                fail("empty key inserted");
+            } catch (const std::invalid_argument&) {
+            }
+        }
+        if (full.bucket_count() != buckets || full.size() != 8 || full.contains(100) ||
+            full_set.bucket_count() != buckets || full_set.size() != 8)
+            fail("failed insert grew the map");
+        auto copy = map;
+        map.clear();
+        if (!map.empty() || map.begin() != map.end() || copy.size() != size)
+            fail("wrong sentinel clear");
+
+        HashSet<int, std::hash<int>, std::equal_to<int>, SentinelStorage<0>> set{1, 2, 3, 2};
+        int x[3] = {};
+        HashMap<int*, int, std::hash<int*>, std::equal_to<int*>, SentinelStorage<nullptr>> pointers{{x, 0}, {x + 2, 2}};
+        if (set.size() != 3 || set.contains(0) || !set.insert(-1).second || pointers.at(x + 2) != 2 ||
+            pointers.contains(nullptr))
+            fail("wrong sentinel set or pointer keys");
+        std::cerr << "ok!\n";
+    }
+
+/* check that interleaved prefetch / resolve lookups give the results of find */
+    template <class Map, class Key, class = void> struct can_prefetch_temporary : std::false_type {};
+    template <class Map, class Key>
+    struct can_prefetch_temporary<Map, Key, std::void_t<decltype(std::declval<const Map&>().prefetch(std::declval<Key>()))>>
+        : std::true_type {};
+
+    template <class Storage>
+    void check_pending_lookups() {
+        std::cerr << "check pending lookups... ";
+        if (can_prefetch_temporary<HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage>, int>::value ||
+            can_prefetch_temporary<HashMap<std::string, int, std::hash<std::string>, std::equal_to<std::string>,
+                                           Storage>, const char*>::value ||
+            can_prefetch_temporary<HashMap<std::string, int, FastHash<std::string>, std::equal_to<>, Storage>,
+                                   std::string_view>::value)
+            fail("a temporary key can be prefetched");
+        HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage> first;
+        HashMap<std::string, int, std::hash<std::string>, std::equal_to<std::string>, Storage> second;
+        for (int i = 0; i < 20000; i += 2) {
+            first[i] = i;
+            second[std::to_string(i)] = i;
+        }
+        std::vector<int> keys;
+        std::vector<std::string> names;
+        for (int i = 0; i < 1000; ++i) {
+            keys.push_back(rand() % 25000);
+            names.push_back(std::to_string(rand() % 25000));
+        }
+        using FirstLookup = decltype(first.prefetch(keys[0]));
+        using SecondLookup = decltype(second.prefetch(names[0]));
+        std::vector<FirstLookup> pending_first;
+        std::vector<SecondLookup> pending_second;
+        for (int i = 0; i < 1000; ++i) {
+            pending_first.push_back(first.prefetch(keys[i]));
+            pending_second.push_back(second.prefetch(names[i]));
+        }
+        for (int i = 0; i < 1000; ++i) {
+            if (first.resolve(pending_first[i]) != first.find(keys[i]) ||
+                second.resolve(pending_second[i]) != second.find(names[i]))
+                fail("resolve disagrees with find");
+        }
+        // a lookup outlives modifications, it resolves against the current table
+        int erased = 4;
+        auto pending = first.prefetch(erased);
+        first.erase(erased);
+        for (int i = 1; i < 100000; i += 2)
+            first[i] = i;
+        const auto& const_first = first;
+        int added = 99999;
+        if (const_first.resolve(pending) != const_first.end() || first.resolve(first.prefetch(added))->second != 99999)
+            fail("wrong resolve after modification");
+
+        HashMap<std::string, int, FastHash<std::string>, std::equal_to<>, Storage> transparent{{"key", 1}};
+        HashMap<int, int, std::hash<int>, std::equal_to<int>, Storage> empty;
+        std::string_view view("key");
+        int absent = 5;
+        if (transparent.resolve(transparent.prefetch(view))->second != 1 ||
+            empty.resolve(empty.prefetch(absent)) != empty.end())
+            fail("wrong transparent or empty resolve");
+        std::cerr << "ok!\n";
+    }
+
+/* check merge and merge_with against std::map: kept and combined values, moved elements, seeded hashers */
+    template <class Storage>
+    void check_merge() {
+        std::cerr << "check merge... ";
+        using Map = HashMap<std::string, int, std::hash<std::string>, std::equal_to<std::string>, Storage>;
+        Map base;
+        Map delta;
+        std::map<std::string, int> expected;
+        for (int i = 0; i < 3000; ++i) {
+            base[std::to_string(i)] = i;
+            expected[std::to_string(i)] = i;
+        }
+        for (int i = 2000; i < 6000; ++i) {
+            delta[std::to_string(i)] = -i;
+            expected.emplace(std::to_string(i), -i);
+        }
+        const int* moved = &delta.at("5000");
+        size_t buckets = delta.bucket_count();
+        if (base.merge(std::move(delta)) != 3000 || base.size() != expected.size())
+            fail("wrong merged count");
+        for (const auto& keyvalue : expected) {
+            if (base.at(keyvalue.first) != keyvalue.second)
+                fail("merge overwrote a value");
+        }
+        if (!delta.empty() || delta.bucket_count() != buckets || delta.find("5000") != delta.end())
+            fail("merged map not left empty");
+        if (std::is_same<Storage, StableStorage>::value && &base.at("5000") != moved)
+            fail("stable element was copied");
+        if (base.merge(std::move(base)) != 0 || base.size() != expected.size() || base.merge(std::move(delta)) != 0)
+            fail("self or empty merge changed the map");
+
+        // the delta is refilled in place and combined into the base
+        for (int i = 0; i < 8000; i += 2)
+            delta[std::to_string(i)] = 1;
+        size_t combined = 0;
+        size_t inserted = base.merge_with(std::move(delta), [&](int& value, int&& other) {
+            value += other;
+            combined++;
+        });
+        if (inserted != 1000 || combined != 3000 || base.at("2") != 3 || base.at("5001") != -5001 ||
+            base.at("7998") != 1 || !delta.empty())
+            fail("wrong merge_with");
+
+        // hashers of different seeds hash the keys again
+        HashMap<int, int, FastHash<int>, std::equal_to<int>, Storage> first(FastHash<int>(1));
+        HashMap<int, int, FastHash<int>, std::equal_to<int>, Storage> second(FastHash<int>(2));
+        for (int i = 0; i < 1000; ++i) {
+            first[i] = i;
+            second[i + 500] = i + 500;
+        }
+        first.merge(std::move(second));
+        for (int i = 0; i < 1500; ++i) {
+            if (first.find(i) == first.end() || first.at(i) != i)
+                fail("wrong merge of seeded maps");
+        }
+
+        HashSet<std::string, std::hash<std::string>, std::equal_to<std::string>, Storage> set{"a", "b"};
+        HashSet<std::string, std::hash<std::string>, std::equal_to<std::string>, Storage> other_set{"b", "c"};
+        if (set.merge(std::move(other_set)) != 1 || set.size() != 3 || !set.contains("c") || !other_set.empty())
+            fail("wrong set merge");
+        std::cerr << "ok!\n";
+    }
+
     void run_all() {
         const_check();
         exception_check();
@@ -265,6 +1770,58 @@ namespace internal_tests {
         check_destructor();
         check_copy();
         check_iterators();
+        check_random_ops<NodeStorage>();
+        check_random_ops<SplitStorage>();
+        check_random_ops<NodeStorage, true>();
+        check_random_ops<SplitStorage, true>();
+        check_random_ops<StableStorage>();
+        check_random_ops<StableStorage, true>();
+        check_random_ops<SentinelStorage<-1>>();
+        check_random_ops<SentinelStorage<-1>, true>();
+        check_split_storage();
+        check_churn();
+        check_reserve();
+        check_move();
+        check_find_or_insert();
+        check_transparent();
+        check_stored_hash<NodeStorage>();
+        check_stored_hash<SplitStorage>();
+        check_incremental();
+        check_allocator<NodeStorage>();
+        check_allocator<SplitStorage>();
+        check_allocator<StableStorage>();
+        check_concurrent();
+        check_sharded();
+        check_batch<NodeStorage>();
+        check_batch<SplitStorage>();
+        check_parallel_build<NodeStorage, std::hash<int>>();
+        check_parallel_build<SplitStorage, BadHash>();
+        check_snapshot<NodeStorage>();
+        check_snapshot<SplitStorage>();
+        check_snapshot<SentinelStorage<-1LL>>();
+        check_frozen<std::hash<int>>();
+        check_frozen<BadHash>();
+        check_max_psl<NodeStorage>();
+        check_max_psl<SplitStorage>();
+        check_stats<NodeStorage>();
+        check_stats<SplitStorage>();
+        check_for_each<NodeStorage>();
+        check_for_each<SplitStorage>();
+        check_clear<NodeStorage>();
+        check_clear<SplitStorage>();
+        check_clear<StableStorage>();
+        check_small();
+        check_set<NodeStorage>();
+        check_set<SplitStorage>();
+        check_set<StableStorage>();
+        check_stable();
+        check_sentinel();
+        check_pending_lookups<NodeStorage>();
+        check_pending_lookups<SplitStorage>();
+        check_merge<NodeStorage>();
+        check_merge<SplitStorage>();
+        check_merge<StableStorage>();
+        check_hashers();
     }
 } // namespace internal_tests
 